@@ -37,6 +37,8 @@ public class HLSLMaterialEditor : ModuleRules
                 "MaterialEditor",
                 "HLSLMaterialRuntime",
                 "DeveloperSettings",
+                "Json",
+                "Sockets",
             });
 
         PrivateIncludePaths.Add(Path.Combine(EngineDirectory, "Source/Developer/MessageLog/Private/"));
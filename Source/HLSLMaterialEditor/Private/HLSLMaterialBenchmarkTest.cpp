@@ -0,0 +1,337 @@
+// Copyright Phyronnaz
+
+#include "CoreMinimal.h"
+#include "HLSLMaterialMessages.h"
+#include "HLSLMaterialFunctionLibrary.h"
+#include "HLSLMaterialFunctionLibraryEditor.h"
+
+#include "ShaderCore.h"
+#include "Misc/FileHelper.h"
+#include "Misc/AutomationTest.h"
+#include "HAL/PlatformMemory.h"
+#include "UObject/UObjectArray.h"
+#include "Materials/MaterialFunction.h"
+
+#if WITH_DEV_AUTOMATION_TESTS
+
+// Measures full regenerations of synthetic libraries: first run, no-op rerun, single function edit and shared include edit
+//
+// UnrealEditor-Cmd MyProject -nullrhi -unattended -ExecCmds="Automation RunTests HLSLMaterial.Benchmark; Quit"
+//
+// -HLSLMaterialBenchmarkSizes=10x4x0x0,100x8x2x1 overrides the sizes, each being FunctionsxArgumentsxStaticBoolsxTextures.
+// Every function also gets an exposed float4x4 pin
+// -HLSLMaterialBenchmarkMaxSeconds=NoOpRerun=0.5,OneFunctionEdit=2 & -HLSLMaterialBenchmarkMaxMemoryMB=FirstRun=200 fail the test
+// if a pass exceeds its threshold. Memory is the change of the process used physical memory over the pass
+// The no-op rerun must never create any UObject nor update any function, the function edit must only update the edited function,
+// and the shared include edit must update all of them as they all call into it
+//
+// Results are appended to Saved/HLSLMaterial/Benchmark.csv
+namespace HLSLMaterialBenchmark
+{
+	struct FSize
+	{
+		int32 NumFunctions = 0;
+		int32 NumArguments = 0;
+		int32 NumStaticBools = 0;
+		int32 NumTextures = 0;
+
+		bool Parse(const FString& String)
+		{
+			TArray<FString> Values;
+			String.ParseIntoArray(Values, TEXT("x"));
+			if (Values.Num() != 4)
+			{
+				return false;
+			}
+
+			NumFunctions = FCString::Atoi(*Values[0]);
+			NumArguments = FCString::Atoi(*Values[1]);
+			NumStaticBools = FCString::Atoi(*Values[2]);
+			NumTextures = FCString::Atoi(*Values[3]);
+			return NumFunctions > 0;
+		}
+		FString ToString() const
+		{
+			return FString::Printf(TEXT("%dx%dx%dx%d"), NumFunctions, NumArguments, NumStaticBools, NumTextures);
+		}
+	};
+
+	// eg NoOpRerun=0.5,OneFunctionEdit=2
+	TMap<FString, double> ParseThresholds(const TCHAR* Switch)
+	{
+		TMap<FString, double> Thresholds;
+
+		FString String;
+		if (!FParse::Value(FCommandLine::Get(), Switch, String))
+		{
+			return Thresholds;
+		}
+
+		TArray<FString> Entries;
+		String.ParseIntoArray(Entries, TEXT(","));
+		for (const FString& Entry : Entries)
+		{
+			FString Pass;
+			FString Value;
+			if (Entry.Split(TEXT("="), &Pass, &Value))
+			{
+				Thresholds.Add(Pass.TrimStartAndEnd(), FCString::Atod(*Value));
+			}
+		}
+		return Thresholds;
+	}
+
+	// Counts the UObjects created, from any thread
+	class FObjectCounter : public FUObjectArray::FUObjectCreateListener
+	{
+	public:
+		FThreadSafeCounter NumCreated;
+
+		FObjectCounter()
+		{
+			GUObjectArray.AddUObjectCreateListener(this);
+		}
+		virtual ~FObjectCounter() override
+		{
+			GUObjectArray.RemoveUObjectCreateListener(this);
+		}
+
+		//~ Begin FUObjectCreateListener Interface
+		virtual void NotifyUObjectCreated(const UObjectBase* Object, int32 Index) override
+		{
+			NumCreated.Increment();
+		}
+		virtual void OnUObjectArrayShutdown() override
+		{
+			GUObjectArray.RemoveUObjectCreateListener(this);
+		}
+		//~ End FUObjectCreateListener Interface
+	};
+
+	FString GenerateLibraryText(const FSize& Size, int32 EditedFunction)
+	{
+		static const TCHAR* Types[] = { TEXT("float"), TEXT("float2"), TEXT("float3"), TEXT("float4") };
+
+		FString Text = "#include \"/HLSLMaterialBenchmark/BenchmarkShared.ush\"\n\n#define BENCHMARK_SCALE 2\n\n";
+
+		for (int32 FunctionIndex = 0; FunctionIndex < Size.NumFunctions; FunctionIndex++)
+		{
+			TArray<FString> Arguments;
+			FString Body = "\tResult = 0;\n";
+
+			Text += FString::Printf(TEXT("// Benchmark function %d\n"), FunctionIndex);
+
+			for (int32 Index = 0; Index < Size.NumArguments; Index++)
+			{
+				const TCHAR* Type = Types[Index % UE_ARRAY_COUNT(Types)];
+				Text += FString::Printf(TEXT("// @param A%d Argument %d\n"), Index, Index);
+				Arguments.Add(FString::Printf(TEXT("%s A%d = 1"), Type, Index));
+				Body += FString::Printf(TEXT("\tResult += A%d%s * BENCHMARK_SCALE;\n"), Index, Index % 4 == 0 ? TEXT("") : TEXT(".x"));
+			}
+			for (int32 Index = 0; Index < Size.NumStaticBools; Index++)
+			{
+				Arguments.Add(FString::Printf(TEXT("bool B%d = false"), Index));
+				Body += FString::Printf(TEXT("\tif (B%d)\n\t{\n\t\tResult *= %d;\n\t}\n"), Index, Index + 2);
+			}
+			for (int32 Index = 0; Index < Size.NumTextures; Index++)
+			{
+				Arguments.Add(FString::Printf(TEXT("Texture2D T%d"), Index));
+				Arguments.Add(FString::Printf(TEXT("SamplerState T%dSampler"), Index));
+				Body += FString::Printf(TEXT("\tResult += Texture2DSample(T%d, T%dSampler, Result.xy).rgb;\n"), Index, Index);
+			}
+
+			Arguments.Add("[Expose] float4x4 Matrix");
+			Body += "\tResult = mul(Matrix, float4(Result, 1)).xyz;\n";
+			Body += "\tResult = BenchmarkShared(Result);\n";
+
+			if (FunctionIndex == EditedFunction)
+			{
+				Body += "\tResult *= 0.5f;\n";
+			}
+
+			Arguments.Add("out float3 Result");
+
+			Text += FString::Printf(TEXT("void Function%d(%s)\n{\n%s}\n\n"), FunctionIndex, *FString::Join(Arguments, TEXT(", ")), *Body);
+		}
+
+		return Text;
+	}
+
+	FString GenerateIncludeText(int32 Version)
+	{
+		return FString::Printf(TEXT("#pragma once\n\n// Version %d\nfloat3 BenchmarkShared(float3 Value)\n{\n\treturn Value * %d;\n}\n"), Version, Version + 1);
+	}
+}
+
+IMPLEMENT_COMPLEX_AUTOMATION_TEST(FHLSLMaterialBenchmarkTest, "HLSLMaterial.Benchmark", EAutomationTestFlags::EditorContext | EAutomationTestFlags::PerfFilter)
+
+void FHLSLMaterialBenchmarkTest::GetTests(TArray<FString>& OutBeautifiedNames, TArray<FString>& OutTestCommands) const
+{
+	FString SizesString = "10x4x0x0,50x8x2x1,200x8x3x2";
+	FParse::Value(FCommandLine::Get(), TEXT("HLSLMaterialBenchmarkSizes="), SizesString);
+
+	TArray<FString> Sizes;
+	SizesString.ParseIntoArray(Sizes, TEXT(","));
+	for (const FString& Size : Sizes)
+	{
+		OutBeautifiedNames.Add(Size);
+		OutTestCommands.Add(Size);
+	}
+}
+
+bool FHLSLMaterialBenchmarkTest::RunTest(const FString& Parameters)
+{
+	using namespace HLSLMaterialBenchmark;
+
+	FSize Size;
+	if (!Size.Parse(Parameters))
+	{
+		AddError(FString::Printf(TEXT("Invalid size %s: expected FunctionsxArgumentsxStaticBoolsxTextures"), *Parameters));
+		return false;
+	}
+
+	const TMap<FString, double> MaxSeconds = ParseThresholds(TEXT("HLSLMaterialBenchmarkMaxSeconds="));
+	const TMap<FString, double> MaxMemoryMB = ParseThresholds(TEXT("HLSLMaterialBenchmarkMaxMemoryMB="));
+
+	// Includes need to be resolvable through a virtual shader path
+	const FString Directory = FPaths::ConvertRelativePathToFull(FPaths::ProjectIntermediateDir() / TEXT("HLSLMaterialBenchmark"));
+	const FString VirtualDirectory = "/HLSLMaterialBenchmark";
+	IFileManager::Get().MakeDirectory(*Directory, true);
+	if (!AllShaderSourceDirectoryMappings().Contains(VirtualDirectory))
+	{
+		AddShaderSourceDirectoryMapping(VirtualDirectory, Directory);
+	}
+
+	const FString Name = "Benchmark_" + Size.ToString();
+	const FString FilePath = Directory / Name + ".hlsl";
+	const FString IncludePath = Directory / TEXT("BenchmarkShared.ush");
+
+	UPackage* Package = CreatePackage(*("/Temp/HLSLMaterialBenchmark/" + Name));
+	UHLSLMaterialFunctionLibrary* Library = NewObject<UHLSLMaterialFunctionLibrary>(Package, *Name, RF_Public | RF_Standalone);
+	Library->File.FilePath = FilePath;
+	Library->bUpdateOnFileChange = false;
+
+	FString Report;
+
+	// StateId only changes when the generated graph or code does
+	const auto GetStateIds = [&]
+	{
+		TMap<FString, FGuid> StateIds;
+		for (const TSoftObjectPtr<UMaterialFunction>& Function : Library->MaterialFunctions)
+		{
+			if (const UMaterialFunction* LoadedFunction = Function.Get())
+			{
+				StateIds.Add(LoadedFunction->GetName(), LoadedFunction->StateId);
+			}
+		}
+		return StateIds;
+	};
+
+	struct FPassResult
+	{
+		double Seconds = 0;
+		int32 NumObjectsCreated = 0;
+		TArray<FString> UpdatedFunctions;
+		double MemoryDeltaMB = 0;
+	};
+	const auto RunPass = [&](const FString& Pass, int32 EditedFunction, int32 IncludeVersion)
+	{
+		ensure(FFileHelper::SaveStringToFile(GenerateLibraryText(Size, EditedFunction), *FilePath));
+		ensure(FFileHelper::SaveStringToFile(GenerateIncludeText(IncludeVersion), *IncludePath));
+
+		// Errors & warnings are reported to the test instead of being shown
+		FHLSLMaterialMessages::FCaptureScope CaptureScope;
+
+		FPassResult Result;
+		{
+			const TMap<FString, FGuid> PreviousStateIds = GetStateIds();
+			const FObjectCounter ObjectCounter;
+			const uint64 PreviousUsedPhysical = FPlatformMemory::GetStats().UsedPhysical;
+
+			const double StartTime = FPlatformTime::Seconds();
+			FHLSLMaterialFunctionLibraryEditor::Generate(*Library, true);
+			Result.Seconds = FPlatformTime::Seconds() - StartTime;
+
+			Result.MemoryDeltaMB = (int64(FPlatformMemory::GetStats().UsedPhysical) - int64(PreviousUsedPhysical)) / (1024. * 1024.);
+			Result.NumObjectsCreated = ObjectCounter.NumCreated.GetValue();
+
+			for (const auto& It : GetStateIds())
+			{
+				if (PreviousStateIds.FindRef(It.Key) != It.Value)
+				{
+					Result.UpdatedFunctions.Add(It.Key);
+				}
+			}
+			Result.UpdatedFunctions.Sort();
+		}
+
+		for (const FHLSLMaterialMessages::FMessage& Message : CaptureScope.Messages)
+		{
+			if (Message.bIsError)
+			{
+				AddError(Pass + ": " + Message.ToString());
+			}
+			else
+			{
+				AddWarning(Pass + ": " + Message.ToString());
+			}
+		}
+
+		AddInfo(FString::Printf(TEXT("%-20s %8.3fs %8d UObjects %8d updated %8.2fMB"), *Pass, Result.Seconds, Result.NumObjectsCreated, Result.UpdatedFunctions.Num(), Result.MemoryDeltaMB));
+		Report += FString::Printf(TEXT("%s,%s,%f,%d,%d,%f\n"), *Size.ToString(), *Pass, Result.Seconds, Result.NumObjectsCreated, Result.UpdatedFunctions.Num(), Result.MemoryDeltaMB);
+
+		if (const double* Threshold = MaxSeconds.Find(Pass))
+		{
+			TestTrue(FString::Printf(TEXT("%s took %.3fs, over %.3fs"), *Pass, Result.Seconds, *Threshold), Result.Seconds <= *Threshold);
+		}
+		if (const double* Threshold = MaxMemoryMB.Find(Pass))
+		{
+			TestTrue(FString::Printf(TEXT("%s used %.2fMB, over %.2fMB"), *Pass, Result.MemoryDeltaMB, *Threshold), Result.MemoryDeltaMB <= *Threshold);
+		}
+
+		return Result;
+	};
+
+	RunPass("FirstRun", -1, 0);
+
+	int32 NumGenerated = 0;
+	for (const TSoftObjectPtr<UMaterialFunction>& Function : Library->MaterialFunctions)
+	{
+		NumGenerated += Function.Get() ? 1 : 0;
+	}
+	TestEqual("Generated functions", NumGenerated, Size.NumFunctions);
+
+	const FPassResult NoOpResult = RunPass("NoOpRerun", -1, 0);
+	TestEqual("UObjects created by the no-op rerun", NoOpResult.NumObjectsCreated, 0);
+	TestEqual("Functions updated by the no-op rerun", NoOpResult.UpdatedFunctions.Num(), 0);
+
+	const FPassResult OneFunctionResult = RunPass("OneFunctionEdit", 0, 0);
+	TestEqual("Functions updated by the one function edit", FString::Join(OneFunctionResult.UpdatedFunctions, TEXT(", ")), FString("Function0"));
+
+	const FPassResult SharedIncludeResult = RunPass("SharedIncludeEdit", 0, 1);
+	TestEqual("Functions updated by the shared include edit", SharedIncludeResult.UpdatedFunctions.Num(), Size.NumFunctions);
+
+	Library->ClearFlags(RF_Standalone);
+	for (const TSoftObjectPtr<UMaterialFunction>& Function : Library->MaterialFunctions)
+	{
+		if (UObject* Object = Function.Get())
+		{
+			Object->ClearFlags(RF_Standalone);
+		}
+	}
+	CollectGarbage(RF_NoFlags);
+
+	const FString ReportPath = FPaths::ProjectSavedDir() / TEXT("HLSLMaterial") / TEXT("Benchmark.csv");
+	if (!FPaths::FileExists(ReportPath))
+	{
+		Report = "Size,Pass,Seconds,UObjectsCreated,UpdatedFunctions,MemoryDeltaMB\n" + Report;
+	}
+	if (!FFileHelper::SaveStringToFile(Report, *ReportPath, FFileHelper::EEncodingOptions::AutoDetect, &IFileManager::Get(), FILEWRITE_Append))
+	{
+		AddError("Failed to write " + ReportPath);
+	}
+
+	return !HasAnyErrors();
+}
+
+#endif
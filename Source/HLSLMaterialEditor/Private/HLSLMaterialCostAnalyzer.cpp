@@ -0,0 +1,246 @@
+// Copyright Phyronnaz
+
+#include "HLSLMaterialCostAnalyzer.h"
+#include "HLSLMaterialUtilities.h"
+
+#include "RHI.h"
+#include "Misc/ScopeExit.h"
+#include "Engine/Texture.h"
+#include "Engine/Texture2DArray.h"
+#include "MaterialShared.h"
+#include "MaterialStatsCommon.h"
+#include "MaterialEditingLibrary.h"
+#include "Materials/Material.h"
+#include "Materials/MaterialFunction.h"
+#include "Materials/MaterialExpressionAdd.h"
+#include "Materials/MaterialExpressionDotProduct.h"
+#include "Materials/MaterialExpressionStaticBool.h"
+#include "Materials/MaterialExpressionFunctionInput.h"
+#include "Materials/MaterialExpressionScalarParameter.h"
+#include "Materials/MaterialExpressionMaterialFunctionCall.h"
+#include "Materials/MaterialExpressionTextureObjectParameter.h"
+
+FString FHLSLMaterialCostAnalyzer::Measure(UMaterialFunction& Function, EShaderPlatform ShaderPlatform, const TArray<FPermutation>& Permutations, TArray<FCost>& OutCosts)
+{
+	for (const FPermutation& Permutation : Permutations)
+	{
+		const FString Error = MeasurePermutation(Function, ShaderPlatform, Permutation, OutCosts.Emplace_GetRef());
+		if (!Error.IsEmpty())
+		{
+			return Error;
+		}
+	}
+
+	return {};
+}
+
+bool FHLSLMaterialCostAnalyzer::ParseShaderPlatforms(const FString& String, TArray<EShaderPlatform>& OutShaderPlatforms)
+{
+	TArray<FString> Formats;
+	String.ParseIntoArray(Formats, TEXT(","));
+
+	for (const FString& Format : Formats)
+	{
+		const EShaderPlatform ShaderPlatform = ShaderFormatToLegacyShaderPlatform(FName(*Format.TrimStartAndEnd()));
+		if (ShaderPlatform == SP_NumPlatforms)
+		{
+			UE_LOG(LogHLSLMaterial, Error, TEXT("Unknown shader format %s"), *Format);
+			return false;
+		}
+		OutShaderPlatforms.Add(ShaderPlatform);
+	}
+
+	if (OutShaderPlatforms.Num() == 0)
+	{
+		OutShaderPlatforms.Add(GMaxRHIShaderPlatform);
+	}
+	return true;
+}
+
+FString FHLSLMaterialCostAnalyzer::GetShaderPlatformName(EShaderPlatform ShaderPlatform)
+{
+	return LegacyShaderPlatformToShaderFormat(ShaderPlatform).ToString();
+}
+
+FString FHLSLMaterialCostAnalyzer::MeasurePermutation(UMaterialFunction& Function, EShaderPlatform ShaderPlatform, const FPermutation& Permutation, FCost& OutCost)
+{
+	UMaterial* Material = NewObject<UMaterial>(GetTransientPackage(), NAME_None, RF_Transient);
+
+	UMaterialExpressionMaterialFunctionCall* Call = CastChecked<UMaterialExpressionMaterialFunctionCall>(
+		UMaterialEditingLibrary::CreateMaterialExpression(Material, UMaterialExpressionMaterialFunctionCall::StaticClass()));
+	Call->SetMaterialFunction(&Function);
+
+	// Shared by all numeric inputs. Function inputs broadcast scalars to vectors
+	UMaterialExpressionScalarParameter* Scalar = nullptr;
+
+	OutCost.Permutation = Permutation.Name;
+
+	for (FFunctionExpressionInput& Input : Call->FunctionInputs)
+	{
+		if (!Input.ExpressionInput)
+		{
+			continue;
+		}
+
+		switch (Input.ExpressionInput->InputType)
+		{
+		case FunctionInput_StaticBool:
+		{
+			const bool* bValue = Permutation.StaticBools.Find(Input.ExpressionInput->InputName);
+			if (!bValue)
+			{
+				if (!Input.ExpressionInput->bUsePreviewValueAsDefault)
+				{
+					return "No value for static bool input " + Input.ExpressionInput->InputName.ToString();
+				}
+				break;
+			}
+
+			UMaterialExpressionStaticBool* StaticBool = CastChecked<UMaterialExpressionStaticBool>(
+				UMaterialEditingLibrary::CreateMaterialExpression(Material, UMaterialExpressionStaticBool::StaticClass()));
+			StaticBool->Value = *bValue;
+			Input.Input.Connect(0, StaticBool);
+		}
+		break;
+		case FunctionInput_Scalar:
+		case FunctionInput_Vector2:
+		case FunctionInput_Vector3:
+		case FunctionInput_Vector4:
+		{
+			if (!Scalar)
+			{
+				Scalar = CastChecked<UMaterialExpressionScalarParameter>(
+					UMaterialEditingLibrary::CreateMaterialExpression(Material, UMaterialExpressionScalarParameter::StaticClass()));
+				Scalar->ParameterName = "Input";
+			}
+			Input.Input.Connect(0, Scalar);
+		}
+		break;
+		case FunctionInput_Texture2D:
+		case FunctionInput_TextureCube:
+		case FunctionInput_Texture2DArray:
+		case FunctionInput_VolumeTexture:
+		case FunctionInput_TextureExternal:
+		{
+			UMaterialExpressionTextureObjectParameter* Texture = CastChecked<UMaterialExpressionTextureObjectParameter>(
+				UMaterialEditingLibrary::CreateMaterialExpression(Material, UMaterialExpressionTextureObjectParameter::StaticClass()));
+			Texture->ParameterName = Input.ExpressionInput->InputName;
+
+			if (Input.ExpressionInput->InputType == FunctionInput_TextureCube)
+			{
+				Texture->Texture = LoadObject<UTexture>(nullptr, TEXT("/Engine/EngineResources/DefaultTextureCube"));
+			}
+			else if (Input.ExpressionInput->InputType == FunctionInput_VolumeTexture)
+			{
+				Texture->Texture = LoadObject<UTexture>(nullptr, TEXT("/Engine/EngineResources/DefaultVolumeTexture"));
+			}
+			else if (Input.ExpressionInput->InputType == FunctionInput_Texture2DArray)
+			{
+				// No engine default: only the texture type matters to the compiler, so an empty transient array is enough
+				Texture->Texture = NewObject<UTexture2DArray>(GetTransientPackage(), NAME_None, RF_Transient);
+			}
+			else if (Input.ExpressionInput->InputType == FunctionInput_TextureExternal)
+			{
+				// Media textures are the engine external textures. Loaded by name to not depend on MediaAssets
+				UClass* MediaTextureClass = LoadObject<UClass>(nullptr, TEXT("/Script/MediaAssets.MediaTexture"));
+				if (!MediaTextureClass)
+				{
+					return "MediaAssets is needed to measure the cost of external texture inputs: " + Input.ExpressionInput->InputName.ToString();
+				}
+				Texture->Texture = NewObject<UTexture>(GetTransientPackage(), MediaTextureClass, NAME_None, RF_Transient);
+			}
+			Input.Input.Connect(0, Texture);
+		}
+		break;
+		default:
+		{
+			if (!Input.ExpressionInput->bUsePreviewValueAsDefault)
+			{
+				return "Unsupported input type for cost measurement: " + Input.ExpressionInput->InputName.ToString();
+			}
+		}
+		}
+	}
+
+	// Sum the squared length of all the outputs, so that none of them is optimized out
+	UMaterialExpression* Sum = nullptr;
+	for (int32 Index = 0; Index < Call->FunctionOutputs.Num(); Index++)
+	{
+		UMaterialExpressionDotProduct* Dot = CastChecked<UMaterialExpressionDotProduct>(
+			UMaterialEditingLibrary::CreateMaterialExpression(Material, UMaterialExpressionDotProduct::StaticClass()));
+		Dot->A.Connect(Index, Call);
+		Dot->B.Connect(Index, Call);
+
+		if (!Sum)
+		{
+			Sum = Dot;
+			continue;
+		}
+
+		UMaterialExpressionAdd* Add = CastChecked<UMaterialExpressionAdd>(
+			UMaterialEditingLibrary::CreateMaterialExpression(Material, UMaterialExpressionAdd::StaticClass()));
+		Add->A.Connect(0, Sum);
+		Add->B.Connect(0, Dot);
+		Sum = Add;
+	}
+	if (!Sum)
+	{
+		return "Function has no outputs";
+	}
+	UMaterialEditingLibrary::ConnectMaterialProperty(Sum, {}, MP_EmissiveColor);
+
+	// No PostEditChange: it would also kick async compiles for every feature level of this transient material,
+	// when only the resource below is needed. Only refresh what the translator reads from the material
+	Material->UpdateCachedExpressionData();
+
+	FMaterialResource* Resource = Material->AllocateResource();
+	ON_SCOPE_EXIT
+	{
+		delete Resource;
+	};
+
+	Resource->SetMaterial(Material, nullptr, GetMaxSupportedFeatureLevel(ShaderPlatform), EMaterialQualityLevel::High);
+	UE_500_SWITCH(
+		Resource->CacheShaders(ShaderPlatform),
+		Resource->CacheShaders(ShaderPlatform, EMaterialShaderPrecompileMode::Synchronous));
+	Resource->FinishCompilation();
+
+	if (Resource->GetCompileErrors().Num() > 0)
+	{
+		return FString::Printf(TEXT("Failed to compile %s for %s:\n%s"),
+			*OutCost.Permutation,
+			*GetShaderPlatformName(ShaderPlatform),
+			*FString::Join(Resource->GetCompileErrors(), TEXT("\n")));
+	}
+
+	// Same as the material editor stats: report the most expensive representative shader of each stage
+	TArray<FMaterialStatsUtils::FShaderInstructionsInfo> Infos;
+	FMaterialStatsUtils::GetRepresentativeInstructionCounts(Infos, Resource);
+	for (const FMaterialStatsUtils::FShaderInstructionsInfo& Info : Infos)
+	{
+		if (ERepresentativeShader::FirstVertexShader <= Info.ShaderType && Info.ShaderType <= ERepresentativeShader::LastVertexShader)
+		{
+			OutCost.NumVertexInstructions = FMath::Max(OutCost.NumVertexInstructions, Info.InstructionsCount);
+		}
+		else
+		{
+			OutCost.NumPixelInstructions = FMath::Max(OutCost.NumPixelInstructions, Info.InstructionsCount);
+		}
+	}
+
+	OutCost.NumSamplers = Resource->GetSamplerUsage();
+
+	uint32 NumVertexTextureSamples = 0;
+	uint32 NumPixelTextureSamples = 0;
+	Resource->GetEstimatedNumTextureSamples(NumVertexTextureSamples, NumPixelTextureSamples);
+	OutCost.NumVertexTextureSamples = NumVertexTextureSamples;
+	OutCost.NumPixelTextureSamples = NumPixelTextureSamples;
+
+	uint32 NumUVScalars = 0;
+	uint32 NumInterpolatorScalars = 0;
+	Resource->GetUserInterpolatorUsage(NumUVScalars, NumInterpolatorScalars);
+	OutCost.NumUVScalars = NumUVScalars;
+	OutCost.NumInterpolatorScalars = NumInterpolatorScalars;
+
+	return {};
+}
@@ -0,0 +1,46 @@
+// Copyright Phyronnaz
+
+#pragma once
+
+#include "CoreMinimal.h"
+#include "RHIDefinitions.h"
+
+class UMaterialFunction;
+
+class FHLSLMaterialCostAnalyzer
+{
+public:
+	struct FPermutation
+	{
+		// eg "bUseNormal=true Mode=Smooth", empty if there are no static pins
+		FString Name;
+		// Value of each static bool function input, by input name
+		TMap<FName, bool> StaticBools;
+	};
+
+	struct FCost
+	{
+		// Name of the permutation
+		FString Permutation;
+
+		int32 NumVertexInstructions = 0;
+		int32 NumPixelInstructions = 0;
+		int32 NumSamplers = 0;
+		int32 NumVertexTextureSamples = 0;
+		int32 NumPixelTextureSamples = 0;
+		int32 NumUVScalars = 0;
+		int32 NumInterpolatorScalars = 0;
+	};
+
+	// Compile the function in a transient material for ShaderPlatform, once per permutation
+	// Numeric inputs are fed a scalar parameter so that they aren't constant folded
+	// Static bool inputs missing from a permutation use their default value
+	static FString Measure(UMaterialFunction& Function, EShaderPlatform ShaderPlatform, const TArray<FPermutation>& Permutations, TArray<FCost>& OutCosts);
+
+	// eg SF_VULKAN_SM5. Empty list means the editor shader platform
+	static bool ParseShaderPlatforms(const FString& String, TArray<EShaderPlatform>& OutShaderPlatforms);
+	static FString GetShaderPlatformName(EShaderPlatform ShaderPlatform);
+
+private:
+	static FString MeasurePermutation(UMaterialFunction& Function, EShaderPlatform ShaderPlatform, const FPermutation& Permutation, FCost& OutCost);
+};
@@ -0,0 +1,208 @@
+// Copyright Phyronnaz
+
+#include "HLSLMaterialCostReportCommandlet.h"
+#include "HLSLMaterialUtilities.h"
+#include "HLSLMaterialCostAnalyzer.h"
+#include "HLSLMaterialFunctionLibrary.h"
+#include "HLSLMaterialFunctionGenerator.h"
+#include "HLSLMaterialFunctionLibraryEditor.h"
+#include "Misc/FileHelper.h"
+#include "Materials/MaterialFunction.h"
+#include "AssetRegistry/AssetRegistryModule.h"
+
+UHLSLMaterialCostReportCommandlet::UHLSLMaterialCostReportCommandlet()
+{
+	IsClient = false;
+	IsServer = false;
+	IsEditor = true;
+	LogToConsole = true;
+}
+
+int32 UHLSLMaterialCostReportCommandlet::Main(const FString& Params)
+{
+	FString PlatformsString;
+	FParse::Value(*Params, TEXT("Platforms="), PlatformsString);
+
+	TArray<EShaderPlatform> ShaderPlatforms;
+	if (!FHLSLMaterialCostAnalyzer::ParseShaderPlatforms(PlatformsString, ShaderPlatforms))
+	{
+		return 1;
+	}
+
+	FString ReportPath;
+	FParse::Value(*Params, TEXT("Report="), ReportPath);
+
+	TArray<UHLSLMaterialFunctionLibrary*> Libraries;
+	{
+		FString LibrariesString;
+		if (FParse::Value(*Params, TEXT("Libraries="), LibrariesString))
+		{
+			TArray<FString> LibraryPaths;
+			LibrariesString.ParseIntoArray(LibraryPaths, TEXT(","));
+			for (const FString& LibraryPath : LibraryPaths)
+			{
+				UHLSLMaterialFunctionLibrary* Library = LoadObject<UHLSLMaterialFunctionLibrary>(nullptr, *LibraryPath);
+				if (!Library)
+				{
+					UE_LOG(LogHLSLMaterial, Error, TEXT("Failed to load library %s"), *LibraryPath);
+					return 1;
+				}
+				Libraries.Add(Library);
+			}
+		}
+		else
+		{
+			IAssetRegistry& AssetRegistry = FModuleManager::LoadModuleChecked<FAssetRegistryModule>(TEXT("AssetRegistry")).Get();
+			AssetRegistry.SearchAllAssets(true);
+
+			TArray<FAssetData> AssetDatas;
+			AssetRegistry.GetAssetsByClass(UE_501_SWITCH(UHLSLMaterialFunctionLibrary::StaticClass()->GetFName(), UHLSLMaterialFunctionLibrary::StaticClass()->GetClassPathName()), AssetDatas);
+
+			for (const FAssetData& AssetData : AssetDatas)
+			{
+				if (UHLSLMaterialFunctionLibrary* Library = Cast<UHLSLMaterialFunctionLibrary>(AssetData.GetAsset()))
+				{
+					Libraries.Add(Library);
+				}
+			}
+		}
+	}
+
+	// Sort to keep the combined report stable
+	Libraries.Sort([](const UHLSLMaterialFunctionLibrary& A, const UHLSLMaterialFunctionLibrary& B)
+	{
+		return A.GetPathName() < B.GetPathName();
+	});
+
+	const FString Header = FString::Printf(
+		TEXT("# HLSL Material cost report v%d\n")
+		TEXT("Library,Function,Permutation,Platform,VertexInstructions,PixelInstructions,Samplers,VertexTextureSamples,PixelTextureSamples,UVScalars,InterpolatorScalars\n"),
+		ReportVersion);
+
+	bool bSuccess = true;
+	FString CombinedReport = Header;
+	for (UHLSLMaterialFunctionLibrary* Library : Libraries)
+	{
+		FString Report;
+		if (!GenerateReport(*Library, ShaderPlatforms, Report))
+		{
+			bSuccess = false;
+		}
+
+		if (!ReportPath.IsEmpty())
+		{
+			CombinedReport += Report;
+			continue;
+		}
+
+		const FString LibraryReportPath = Library->GetFilePath() + ".cost.csv";
+		if (!FFileHelper::SaveStringToFile(Header + Report, *LibraryReportPath))
+		{
+			UE_LOG(LogHLSLMaterial, Error, TEXT("Failed to write %s"), *LibraryReportPath);
+			return 1;
+		}
+		UE_LOG(LogHLSLMaterial, Display, TEXT("Report written to %s"), *LibraryReportPath);
+	}
+
+	if (!ReportPath.IsEmpty())
+	{
+		if (!FFileHelper::SaveStringToFile(CombinedReport, *ReportPath))
+		{
+			UE_LOG(LogHLSLMaterial, Error, TEXT("Failed to write %s"), *ReportPath);
+			return 1;
+		}
+		UE_LOG(LogHLSLMaterial, Display, TEXT("Report written to %s"), *ReportPath);
+	}
+
+	return bSuccess ? 0 : 1;
+}
+
+bool UHLSLMaterialCostReportCommandlet::GenerateReport(UHLSLMaterialFunctionLibrary& Library, const TArray<EShaderPlatform>& ShaderPlatforms, FString& OutReport)
+{
+	TArray<UMaterialFunction*> Functions;
+	for (const TSoftObjectPtr<UMaterialFunction>& Function : Library.MaterialFunctions)
+	{
+		if (UMaterialFunction* LoadedFunction = Function.LoadSynchronous())
+		{
+			Functions.Add(LoadedFunction);
+		}
+	}
+	Functions.Sort([](const UMaterialFunction& A, const UMaterialFunction& B)
+	{
+		return A.GetName() < B.GetName();
+	});
+
+	// Permutations come from the HLSL, so that the rows match the generated Custom nodes
+	TMap<FString, TArray<FHLSLMaterialCostAnalyzer::FPermutation>> FunctionPermutations;
+	{
+		FString Text;
+		FHLSLMaterialFunctionLibraryEditor::FPreparedLibrary PreparedLibrary;
+		if (!FHLSLMaterialFunctionLibraryEditor::TryLoadFileToString(Text, Library.GetFilePath()) ||
+			!FHLSLMaterialFunctionLibraryEditor::Prepare(Library, Text, PreparedLibrary))
+		{
+			UE_LOG(LogHLSLMaterial, Error, TEXT("%s: failed to parse %s"), *Library.GetPathName(), *Library.GetFilePath());
+			return false;
+		}
+
+		for (const FHLSLMaterialFunction& Function : PreparedLibrary.Functions)
+		{
+			FHLSLMaterialFunctionGenerator::FAnalysis Analysis;
+			if (FHLSLMaterialFunctionGenerator::AnalyzeFunction(Library, Function, Analysis).IsEmpty())
+			{
+				FunctionPermutations.Add(Function.Name, FHLSLMaterialFunctionGenerator::GetCostPermutations(Analysis));
+			}
+		}
+	}
+
+	bool bSuccess = true;
+	for (UMaterialFunction* Function : Functions)
+	{
+		const TArray<FHLSLMaterialCostAnalyzer::FPermutation>* Permutations = FunctionPermutations.Find(Function->GetName());
+		if (!Permutations)
+		{
+			UE_LOG(LogHLSLMaterial, Error, TEXT("%s: %s: not found in %s"), *Library.GetPathName(), *Function->GetName(), *Library.GetFilePath());
+			bSuccess = false;
+			continue;
+		}
+
+		for (const EShaderPlatform ShaderPlatform : ShaderPlatforms)
+		{
+			const FString Platform = FHLSLMaterialCostAnalyzer::GetShaderPlatformName(ShaderPlatform);
+
+			TArray<FHLSLMaterialCostAnalyzer::FCost> Costs;
+			const FString Error = FHLSLMaterialCostAnalyzer::Measure(*Function, ShaderPlatform, *Permutations, Costs);
+			if (!Error.IsEmpty())
+			{
+				UE_LOG(LogHLSLMaterial, Error, TEXT("%s: %s: %s"), *Library.GetPathName(), *Function->GetName(), *Error);
+				bSuccess = false;
+				continue;
+			}
+
+			for (const FHLSLMaterialCostAnalyzer::FCost& Cost : Costs)
+			{
+				UE_LOG(LogHLSLMaterial, Display, TEXT("%-30s %-20s %-40s VS %4d PS %4d Samplers %2d"),
+					*Function->GetName(),
+					*Platform,
+					*Cost.Permutation,
+					Cost.NumVertexInstructions,
+					Cost.NumPixelInstructions,
+					Cost.NumSamplers);
+
+				OutReport += FString::Printf(TEXT("%s,%s,%s,%s,%d,%d,%d,%d,%d,%d,%d\n"),
+					*Library.GetPathName(),
+					*Function->GetName(),
+					*Cost.Permutation,
+					*Platform,
+					Cost.NumVertexInstructions,
+					Cost.NumPixelInstructions,
+					Cost.NumSamplers,
+					Cost.NumVertexTextureSamples,
+					Cost.NumPixelTextureSamples,
+					Cost.NumUVScalars,
+					Cost.NumInterpolatorScalars);
+			}
+		}
+	}
+
+	return bSuccess;
+}
@@ -0,0 +1,35 @@
+// Copyright Phyronnaz
+
+#pragma once
+
+#include "CoreMinimal.h"
+#include "RHIDefinitions.h"
+#include "Commandlets/Commandlet.h"
+#include "HLSLMaterialCostReportCommandlet.generated.h"
+
+class UHLSLMaterialFunctionLibrary;
+
+// Compiles each generated function in a minimal material and reports its cost, per permutation of its static pins & shader platform
+//
+// UnrealEditor-Cmd MyProject -run=HLSLMaterialCostReport -nullrhi [-Libraries=/Game/A,/Game/B] [-Platforms=SF_VULKAN_SM5,SF_VULKAN_ES31_ANDROID] [-Report=Path.csv]
+//
+// By default all libraries are processed, and each report is written next to the library HLSL file as File.hlsl.cost.csv
+// so that it can be reviewed along with the code. Platforms default to the editor one, and need their shader compiler to be available
+UCLASS()
+class UHLSLMaterialCostReportCommandlet : public UCommandlet
+{
+	GENERATED_BODY()
+
+public:
+	UHLSLMaterialCostReportCommandlet();
+
+	//~ Begin UCommandlet Interface
+	virtual int32 Main(const FString& Params) override;
+	//~ End UCommandlet Interface
+
+	// Bump when the columns change
+	static constexpr int32 ReportVersion = 1;
+
+private:
+	static bool GenerateReport(UHLSLMaterialFunctionLibrary& Library, const TArray<EShaderPlatform>& ShaderPlatforms, FString& OutReport);
+};
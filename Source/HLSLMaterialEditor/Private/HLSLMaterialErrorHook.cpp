@@ -5,6 +5,7 @@
 #include "HLSLMaterialUtilities.h"
 #include "HLSLMaterialFunctionLibrary.h"
 #include "MaterialEditorModule.h"
+#include "Misc/ScopeExit.h"
 #include "Misc/MessageDialog.h"
 #include "Internationalization/Regex.h"
 
@@ -47,18 +48,42 @@ void FHLSLMaterialErrorHook::HookMessageLogHack(IMaterialEditor& MaterialEditor)
 	}
 
 	FMessageLogListingViewModel& ViewModel = static_cast<FMessageLogListingViewModel&>(*Listing);
-	ViewModel.OnDataChanged().AddLambda([&ViewModel]
+	const TSharedRef<FListingState> State = MakeShared<FListingState>();
+	ViewModel.OnDataChanged().AddLambda([&ViewModel, State]
 	{
-		ReplaceMessages(ViewModel);
+		ReplaceMessages(ViewModel, *State);
 	});
 }
 
-void FHLSLMaterialErrorHook::ReplaceMessages(FMessageLogListingViewModel& ViewModel)
+void FHLSLMaterialErrorHook::ReplaceMessages(FMessageLogListingViewModel& ViewModel, FListingState& State)
 {
 	ensure(ViewModel.GetCurrentPageIndex() == 0);
 
+	// [FeatureLevel] /Path(line info): error
+	static const FRegexPattern ShaderPathPattern(R"_((\[.*\] )(\/.*)(\(.*\): .*))_");
+	// Error prefix (line,char) error suffix
+	// Error prefix (line,char-char) error suffix
+	static const FRegexPattern LineCharPattern(R"_(\(([0-9]*),([0-9]*)(-([0-9]*))?\)(.*))_");
+	// Error prefix (line): error suffix
+	// Error prefix (line): (char) error suffix
+	static const FRegexPattern LinePattern(R"_(\(([0-9]*)\): (\(([0-9]*)\))?(.*))_");
+
 	const int32 NumMessages = ViewModel.NumMessages();
-	for (int32 MessageIndex = 0; MessageIndex < NumMessages; MessageIndex++)
+
+	if (State.NumProcessedMessages > NumMessages ||
+		(State.NumProcessedMessages > 0 && ViewModel.GetMessageAtIndex(State.NumProcessedMessages - 1) != State.LastProcessedMessage.Pin()))
+	{
+		// The log was cleared by a new compilation: start over, and don't trust the cached file existence anymore
+		State = {};
+	}
+
+	ON_SCOPE_EXIT
+	{
+		State.NumProcessedMessages = NumMessages;
+		State.LastProcessedMessage = NumMessages > 0 ? ViewModel.GetMessageAtIndex(NumMessages - 1) : nullptr;
+	};
+
+	for (int32 MessageIndex = State.NumProcessedMessages; MessageIndex < NumMessages; MessageIndex++)
 	{
 		const TSharedPtr<FTokenizedMessage> Message = ViewModel.GetMessageAtIndex(MessageIndex);
 		if (!ensure(Message))
@@ -92,15 +117,18 @@ void FHLSLMaterialErrorHook::ReplaceMessages(FMessageLogListingViewModel& ViewMo
 						continue;
 					}
 
-					FullPath = UHLSLMaterialFunctionLibrary::GetFilePath(Path);
+					FullPath = FindFullPath(State.LibraryPathCache, Path, false);
 				}
 				else
 				{
 					// Try to parse a shader file path
+					if (!Error.Contains(TEXT("): ")))
+					{
+						NewTokens.Add(Token);
+						continue;
+					}
 
-					// [FeatureLevel] /Path(line info): error
-					FRegexPattern RegexPattern(R"_((\[.*\] )(\/.*)(\(.*\): .*))_");
-					FRegexMatcher RegexMatcher(RegexPattern, Error);
+					FRegexMatcher RegexMatcher(ShaderPathPattern, Error);
 					if (!RegexMatcher.FindNext())
 					{
 						NewTokens.Add(Token);
@@ -111,12 +139,12 @@ void FHLSLMaterialErrorHook::ReplaceMessages(FMessageLogListingViewModel& ViewMo
 					Path = RegexMatcher.GetCaptureGroup(2);
 					ErrorSuffix = RegexMatcher.GetCaptureGroup(3);
 
-					FullPath = GetShaderSourceFilePath(Path);
+					FullPath = FindFullPath(State.ShaderPathCache, Path, true);
 				}
 			}
 
 			// Avoid doing silly stuff with generated files
-			if (!FPaths::FileExists(FullPath))
+			if (FullPath.IsEmpty())
 			{
 				NewTokens.Add(Token);
 				continue;
@@ -127,10 +155,7 @@ void FHLSLMaterialErrorHook::ReplaceMessages(FMessageLogListingViewModel& ViewMo
 			FString CharEnd;
 
 			{
-				// Error prefix (line,char) error suffix
-				// Error prefix (line,char-char) error suffix
-				FRegexPattern RegexPattern(R"_(\(([0-9]*),([0-9]*)(-([0-9]*))?\)(.*))_");
-				FRegexMatcher RegexMatcher(RegexPattern, ErrorSuffix);
+				FRegexMatcher RegexMatcher(LineCharPattern, ErrorSuffix);
 				if (RegexMatcher.FindNext())
 				{
 					LineNumber = RegexMatcher.GetCaptureGroup(1);
@@ -142,10 +167,7 @@ void FHLSLMaterialErrorHook::ReplaceMessages(FMessageLogListingViewModel& ViewMo
 
 			if (LineNumber.IsEmpty())
 			{
-				// Error prefix (line): error suffix
-				// Error prefix (line): (char) error suffix
-				FRegexPattern RegexPattern(R"_(\(([0-9]*)\): (\(([0-9]*)\))?(.*))_");
-				FRegexMatcher RegexMatcher(RegexPattern, ErrorSuffix);
+				FRegexMatcher RegexMatcher(LinePattern, ErrorSuffix);
 				if (RegexMatcher.FindNext())
 				{
 					LineNumber = RegexMatcher.GetCaptureGroup(1);
@@ -235,4 +257,23 @@ void FHLSLMaterialErrorHook::ReplaceMessages(FMessageLogListingViewModel& ViewMo
 		}
 		HLSL_CONST_CAST(Message->GetMessageTokens()) = NewTokens;
 	}
+}
+
+const FString& FHLSLMaterialErrorHook::FindFullPath(TMap<FString, FString>& Cache, const FString& Path, bool bIsShaderPath)
+{
+	if (const FString* FullPath = Cache.Find(Path))
+	{
+		return *FullPath;
+	}
+
+	FString FullPath = bIsShaderPath
+		? GetShaderSourceFilePath(Path)
+		: UHLSLMaterialFunctionLibrary::GetFilePath(Path);
+
+	if (!FPaths::FileExists(FullPath))
+	{
+		FullPath.Reset();
+	}
+
+	return Cache.Add(Path, FullPath);
 }
\ No newline at end of file
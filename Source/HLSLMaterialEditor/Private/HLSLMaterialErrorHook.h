@@ -5,6 +5,7 @@
 #include "CoreMinimal.h"
 
 class IMaterialEditor;
+class FTokenizedMessage;
 class FMessageLogListingViewModel;
 
 class FHLSLMaterialErrorHook
@@ -16,6 +17,18 @@ public:
 	static void Register();
 
 private:
+	struct FListingState
+	{
+		// Messages before this index have already been replaced
+		int32 NumProcessedMessages = 0;
+		TWeakPtr<FTokenizedMessage> LastProcessedMessage;
+
+		// Path -> full path, empty if the file doesn't exist
+		TMap<FString, FString> LibraryPathCache;
+		TMap<FString, FString> ShaderPathCache;
+	};
+
 	static void HookMessageLogHack(IMaterialEditor& MaterialEditor);
-	static void ReplaceMessages(FMessageLogListingViewModel& ViewModel);
+	static void ReplaceMessages(FMessageLogListingViewModel& ViewModel, FListingState& State);
+	static const FString& FindFullPath(TMap<FString, FString>& Cache, const FString& Path, bool bIsShaderPath);
 };
\ No newline at end of file
@@ -5,7 +5,7 @@
 
 FString FHLSLMaterialFunction::GenerateHashedString(const FString& BaseHash) const
 {
-	FString StringToHash =
+	const FString Text =
 		BaseHash +
 		// Changes too often
 		//FString::FromInt(StartLine) + " " +
@@ -16,10 +16,20 @@ FString FHLSLMaterialFunction::GenerateHashedString(const FString& BaseHash) con
 		FString::Join(Arguments, TEXT(",")) + ")" +
 		Body;
 
-	StringToHash.ReplaceInline(TEXT("\t"), TEXT(" "));
-	StringToHash.ReplaceInline(TEXT("\n"), TEXT(" "));
-
-	while (StringToHash.ReplaceInline(TEXT("  "), TEXT(" "))) {}
+	// Collapse all whitespace runs, including \r\n, to a single space
+	FString StringToHash;
+	StringToHash.Reserve(Text.Len());
+	for (int32 Index = 0; Index < Text.Len(); Index++)
+	{
+		if (!FChar::IsWhitespace(Text[Index]))
+		{
+			StringToHash += Text[Index];
+		}
+		else if (StringToHash.Len() == 0 || StringToHash[StringToHash.Len() - 1] != TEXT(' '))
+		{
+			StringToHash += TEXT(' ');
+		}
+	}
 
 	return "HLSL Hash: " + FHLSLMaterialUtilities::HashString(StringToHash);
 }
\ No newline at end of file
@@ -4,9 +4,31 @@
 
 #include "CoreMinimal.h"
 
+struct FHLSLMaterialArgument
+{
+	TMap<FString, FString> Metadata;
+	bool bIsConst = false;
+	bool bIsOutput = false;
+	FString Type;
+	// eg float for Texture2D<float>
+	FString TemplateArgument;
+	FString Name;
+	FString DefaultValue;
+};
+
+struct FHLSLMaterialSignature
+{
+	TMap<FString, FString> Metadata;
+	TArray<FHLSLMaterialArgument> Arguments;
+	// Parameter name -> @param documentation
+	TMap<FString, FString> ParamDocs;
+};
+
 struct FHLSLMaterialFunction
 {
 	int32 StartLine = 0;
+	// 1-based line of the return type, for error messages
+	int32 DeclarationLine = 0;
 	FString Comment;
 	FString Metadata;
 	FString ReturnType;
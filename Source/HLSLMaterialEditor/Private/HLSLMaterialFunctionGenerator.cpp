@@ -3,18 +3,21 @@
 #include "HLSLMaterialFunctionGenerator.h"
 #include "HLSLMaterialFunction.h"
 #include "HLSLMaterialMessages.h"
+#include "HLSLMaterialParser.h"
+#include "HLSLMaterialTimings.h"
+#include "HLSLMaterialCostAnalyzer.h"
 #include "HLSLMaterialUtilities.h"
 #include "HLSLMaterialErrorHook.h"
 #include "HLSLMaterialFunctionLibrary.h"
+#include "HLSLMaterialPreviewCompilation.h"
 
 #include "Misc/ScopeExit.h"
+#include "Algo/AllOf.h"
+#include "Algo/Reverse.h"
 #include "IMaterialEditor.h"
 #include "MaterialEditorActions.h"
 #include "AssetToolsModule.h"
-#include "Internationalization/Regex.h"
 #include "AssetRegistry/AssetRegistryModule.h"
-#include "Widgets/Notifications/SNotificationList.h"
-#include "Framework/Notifications/NotificationManager.h"
 #include "Engine/Texture2DArray.h"
 #include "UObject/UObjectIterator.h"
 
@@ -26,6 +29,21 @@
 #include "Materials/MaterialExpressionMultiply.h"
 #include "Materials/MaterialExpressionStaticBool.h"
 #include "Materials/MaterialExpressionVertexColor.h"
+#include "Materials/MaterialExpressionLightmapUVs.h"
+#include "Materials/MaterialExpressionParticleSize.h"
+#include "Materials/MaterialExpressionParticleColor.h"
+#include "Materials/MaterialExpressionParticleRandom.h"
+#include "Materials/MaterialExpressionParticleMacroUV.h"
+#include "Materials/MaterialExpressionDynamicParameter.h"
+#include "Materials/MaterialExpressionPerInstanceRandom.h"
+#include "Materials/MaterialExpressionParticleDirection.h"
+#include "Materials/MaterialExpressionParticlePositionWS.h"
+#include "Materials/MaterialExpressionParticleRelativeTime.h"
+#include "Materials/MaterialExpressionPerInstanceCustomData.h"
+#include "Materials/MaterialExpressionPerInstanceFadeAmount.h"
+#include "Materials/MaterialExpressionParticleMotionBlurFade.h"
+#include "Materials/MaterialExpressionVertexNormalWS.h"
+#include "Materials/MaterialExpressionVertexInterpolator.h"
 #include "Materials/MaterialExpressionStaticSwitch.h"
 #include "Materials/MaterialExpressionAppendVector.h"
 #include "Materials/MaterialExpressionWorldPosition.h"
@@ -39,119 +57,75 @@
 
 #include "Editor/MaterialEditor/Private/MaterialEditor.h"
 
-FString FHLSLMaterialFunctionGenerator::GenerateFunction(
-	UHLSLMaterialFunctionLibrary& Library,
-	const TArray<FString>& IncludeFilePaths,
-	const TArray<FCustomDefine>& AdditionalDefines,
-	const TArray<FString>& Structs,
-	FHLSLMaterialFunction Function,
-	FMaterialUpdateContext& UpdateContext)
+FString FHLSLMaterialFunctionGenerator::AnalyzeFunction(const UHLSLMaterialFunctionLibrary& Library, const FHLSLMaterialFunction& Function, FAnalysis& OutAnalysis)
 {
-	TSoftObjectPtr<UMaterialFunction>* MaterialFunctionPtr = Library.MaterialFunctions.FindByPredicate([&](TSoftObjectPtr<UMaterialFunction> InFunction)
-	{
-		return InFunction && InFunction->GetFName() == *Function.Name;
-	});
-	if (!MaterialFunctionPtr)
-	{
-		Library.MarkPackageDirty();
-		MaterialFunctionPtr = &Library.MaterialFunctions.Add_GetRef(nullptr);
-	}
+	TArray<FPin>& Inputs = OutAnalysis.Inputs;
+	TArray<FPin>& Outputs = OutAnalysis.Outputs;
+	FString& VariableDeclarations = OutAnalysis.VariableDeclarations;
 
-	FString BasePath = FPackageName::ObjectPathToPackageName(Library.GetPathName());
-	if (Library.bPutFunctionsInSubdirectory)
-	{
-		BasePath += "_GeneratedFunctions";
-	}
-	else
+	TArray<FSelector> ValuesSelectors;
+
+	if (Function.ReturnType != "void")
 	{
-		BasePath = FPaths::GetPath(BasePath);
+		return "Return type needs to be void";
 	}
 
-	UMaterialFunction* MaterialFunction = MaterialFunctionPtr->Get();
-	if (!MaterialFunction)
+	FHLSLMaterialSignature& Signature = OutAnalysis.Signature;
 	{
-		FString Error;
-		MaterialFunction = CreateAsset<UMaterialFunction>(Function.Name, BasePath, Error);
-
+		const FString Error = FHLSLMaterialParser::ParseSignature(Function, Signature);
 		if (!Error.IsEmpty())
 		{
-			ensure(!MaterialFunction);
 			return Error;
 		}
 	}
-	if (!MaterialFunction)
+	const TMap<FString, FString>& FunctionMetadata = Signature.Metadata;
+
+	// Unknown metadata is ignored, but it's most likely a typo. Only logged, as these would show up on every generation
+	static const TSet<FString> ValidFunctionMetadata =
 	{
-		return "Failed to create asset";
-	}
-	if (*MaterialFunctionPtr != MaterialFunction)
+		FUNC_META_Prefix,
+		FUNC_META_Helper,
+		FUNC_META_MaxInstructions,
+		FUNC_META_MaxSamplers,
+		FUNC_META_MaxPermutations,
+		FUNC_META_DebugOnly,
+		META_Sampler,
+	};
+	static const TSet<FString> ValidPinMetadata =
 	{
-		Library.MarkPackageDirty();
-	}
-	*MaterialFunctionPtr = MaterialFunction;
+		META_Expose,
+		META_Category,
+		META_Sampler,
+		META_Interpolate,
+		META_Static,
+		META_Dynamic,
+		META_Values,
+	};
 
-	for (UMaterialExpressionComment* Comment : MaterialFunction->FunctionEditorComments)
+	for (const auto& It : FunctionMetadata)
 	{
-		if (Comment && Comment->Text.Contains(Function.HashedString))
+		if (!ValidFunctionMetadata.Contains(It.Key))
 		{
-			UE_LOG(LogHLSLMaterial, Log, TEXT("%s already up to date"), *Function.Name);
-			return {};
+			FHLSLMaterialMessages::LogWarningAtLine(Function.DeclarationLine, TEXT("Function %s: unknown metadata %s"), *Function.Name, *It.Key);
 		}
 	}
 
-	TArray<FPin> Inputs;
-	TArray<FPin> Outputs;
-	FString VariableDeclarations;
-
-	if (Function.ReturnType != "void")
+	for (const FHLSLMaterialArgument& Argument : Signature.Arguments)
 	{
-		return "Return type needs to be void";
-	}
+		const bool bIsConst = Argument.bIsConst;
+		const bool bIsOutput = Argument.bIsOutput;
+		const FString& Type = Argument.Type;
+		const FString& Name = Argument.Name;
+		const FString& DefaultValue = Argument.DefaultValue;
 
-	TMap<FString, FString> FunctionMetadata;
-	if (!Function.Metadata.IsEmpty())
-	{
-		TArray<FString> Metadatas;
-		Function.Metadata.ParseIntoArray(Metadatas, TEXT("\n"));
-		for (FString Metadata : Metadatas)
+		for (const auto& It : Argument.Metadata)
 		{
-			Metadata.TrimStartAndEndInline();
-			if (!Metadata.RemoveFromStart("[") ||
-				!Metadata.RemoveFromEnd("]"))
+			if (!ValidPinMetadata.Contains(It.Key))
 			{
-				return "Invalid function metadata: " + Metadata;
+				FHLSLMaterialMessages::LogWarningAtLine(Function.DeclarationLine, TEXT("Function %s: unknown metadata %s on %s"), *Function.Name, *It.Key, *Name);
 			}
-
-			FunctionMetadata.Append(GenerateMetadata(Metadata));
-		}
-	}
-
-	for (const FString& Argument : Function.Arguments)
-	{
-		FRegexPattern RegexPattern(""
-			R"_(^\s*)_"                      // Start
-			R"_((?:\[(.*)\])?)_"             // [Metadata]
-			R"_(\s*)_"                       // Spaces
-			R"_((?:(const\s+)?|(out\s+)?))_" // Either const or out
-			R"_((\w*))_"                     // Type
-			R"_(\s*)_"                       // Spaces
-			R"_((?:<\w+>)?)_"                // Potential (ignored) template, eg Texture2D<float>
-			R"_(\s+)_"                       // Spaces
-			R"_((\w*))_"                     // Name
-			R"_((?:\s*=\s*(.+))?)_"          // Optional default value
-			R"_(\s*$)_");                    // End
-		FRegexMatcher RegexMatcher(RegexPattern, Argument);
-		if (!RegexMatcher.FindNext())
-		{
-			return "Invalid arguments syntax";
 		}
 
-		const FString Metadata = RegexMatcher.GetCaptureGroup(1);
-		const bool bIsConst = !RegexMatcher.GetCaptureGroup(2).IsEmpty();
-		const bool bIsOutput = !RegexMatcher.GetCaptureGroup(3).IsEmpty();
-		const FString Type = RegexMatcher.GetCaptureGroup(4);
-		const FString Name = RegexMatcher.GetCaptureGroup(5);
-		const FString DefaultValue = RegexMatcher.GetCaptureGroup(6);
-
 		if ((Type == "FMaterialPixelParameters" || Type == "FMaterialVertexParameters") &&
 			Name == "Parameters")
 		{
@@ -170,29 +144,120 @@ FString FHLSLMaterialFunctionGenerator::GenerateFunction(
 			// The Custom node will add samplers
 			continue;
 		}
-		if (Type == "float4x4")
+
+		if (const FString* ValuesString = Argument.Metadata.Find(META_Values))
+		{
+			if (bIsOutput || (Type != "int" && Type != "uint"))
+			{
+				return "Values metadata can only be used on int or uint inputs: " + Name;
+			}
+			if (Argument.Metadata.Contains(META_Expose))
+			{
+				return "Cannot expose " + Name + " as a parameter: pins with Values are static";
+			}
+
+			const TArray<FString> Values = ParseValues(*ValuesString);
+			if (Values.Num() < 2)
+			{
+				return "Values needs at least 2 values: " + Name;
+			}
+			for (const FString& Value : Values)
+			{
+				// Values are used in identifiers, eg Mode_A
+				const bool bIsIdentifier = !Value.IsEmpty() && !FChar::IsDigit(Value[0]) && Algo::AllOf(Value, [](TCHAR Char)
+				{
+					return FChar::IsAlnum(Char) || Char == TEXT('_');
+				});
+
+				if (!bIsIdentifier || Values.FilterByPredicate([&](const FString& Other) { return Other == Value; }).Num() > 1)
+				{
+					return "Invalid value for " + Name + ": " + Value;
+				}
+			}
+
+			int32 DefaultIndex = 0;
+			if (!DefaultValue.IsEmpty())
+			{
+				DefaultIndex = Values.IndexOfByKey(DefaultValue);
+				if (DefaultIndex == INDEX_NONE)
+				{
+					return Name + ": invalid default value: " + DefaultValue + ". Valid values are " + FString::Join(Values, TEXT(", "));
+				}
+			}
+
+			FSelector& Selector = ValuesSelectors.Emplace_GetRef();
+			Selector.Name = Name;
+			Selector.Type = Type;
+			Selector.Values = Values;
+			Selector.bIsConst = bIsConst;
+
+			// The first value is selected when none of the static bools are set
+			for (int32 ValueIndex = 1; ValueIndex < Values.Num(); ValueIndex++)
+			{
+				Selector.InputIndices.Add(Inputs.Num());
+
+				// With a default value, all the bools have a default so that only the selected value needs to be wired
+				FString BoolDefaultValue;
+				if (!DefaultValue.IsEmpty())
+				{
+					BoolDefaultValue = ValueIndex == DefaultIndex ? "true" : "false";
+				}
+
+				FPin& Pin = Inputs.Emplace_GetRef(FPin(
+					Name + "_" + Values[ValueIndex],
+					"bool",
+					true,
+					false,
+					true,
+					BoolDefaultValue,
+					Signature.ParamDocs.FindRef(Name),
+					{}));
+				Pin.DisplayName = Name + " = " + Values[ValueIndex];
+
+				const FString Error = Pin.ParseTypeAndDefaultValue();
+				ensure(Error.IsEmpty());
+			}
+
+			if (!Library.bGenerateShaderFile)
+			{
+				// In the shader file, these are declared in the function body
+				VariableDeclarations += GetValueConstants(Name, Values);
+			}
+
+			continue;
+		}
+
+		int32 NumRows = 0;
+		int32 NumColumns = 0;
+		if (GetMatrixDimensions(Type, NumRows, NumColumns))
 		{
 			if (bIsOutput)
 			{
-				return "Cannot have a float4x4 as output: " + Name;
+				return "Cannot have a " + Type + " as output: " + Name;
 			}
 			if (!DefaultValue.IsEmpty())
 			{
-				return "Cannot have a default value for a float4x4 pin: " + Name;
+				return "Cannot have a default value for a " + Type + " pin: " + Name;
 			}
 
-			const TMap<FString, FString> PinMetadata = GenerateMetadata(Metadata);
-			if (!PinMetadata.Contains(META_Expose))
+			// Split the matrix into its rows, or into its columns if there are less of them, eg a float4x3 is passed as 3 float4 columns
+			const bool bUseColumns = NumColumns < NumRows;
+			const int32 NumPins = bUseColumns ? NumColumns : NumRows;
+			const int32 PinDimension = bUseColumns ? NumRows : NumColumns;
+
+			const TMap<FString, FString>& PinMetadata = Argument.Metadata;
+			if (PinMetadata.Contains(META_Expose) && PinDimension == 2)
 			{
-				return "float4x4 pins must be exposed: " + Name;
+				return "Cannot expose type " + Type + " as a parameter";
 			}
-			const FString Tooltip = GenerateTooltip(Name, Function.Comment);
+			const FString Tooltip = Signature.ParamDocs.FindRef(Name);
 
-			for (int32 Index = 0; Index < 4; Index++)
+			TArray<FString> PinValues;
+			for (int32 Index = 0; Index < NumPins; Index++)
 			{
 				FPin& Pin = Inputs.Emplace_GetRef(FPin(
 					Name + FString::FromInt(Index),
-					"float4",
+					"float" + FString::FromInt(PinDimension),
 					true,
 					false,
 					true,
@@ -202,13 +267,22 @@ FString FHLSLMaterialFunctionGenerator::GenerateFunction(
 
 				const FString Error = Pin.ParseTypeAndDefaultValue();
 				ensure(Error.IsEmpty());
+
+				PinValues.Add("INTERNAL_IN_" + Pin.Name);
+			}
+
+			FString Value = FString::Printf(TEXT("%s%dx%d(%s)"),
+				*Type.LeftChop(3),
+				bUseColumns ? NumColumns : NumRows,
+				bUseColumns ? NumRows : NumColumns,
+				*FString::Join(PinValues, TEXT(", ")));
+
+			if (bUseColumns)
+			{
+				Value = "transpose(" + Value + ")";
 			}
 
-			VariableDeclarations += FString(bIsConst ? "const " : "") + "float4x4 " + Name + " = float4x4(" +
-				"INTERNAL_IN_" + Name + "0, " +
-				"INTERNAL_IN_" + Name + "1, " +
-				"INTERNAL_IN_" + Name + "2, " +
-				"INTERNAL_IN_" + Name + "3);\n";
+			VariableDeclarations += FString(bIsConst ? "const " : "") + Type + " " + Name + " = " + Value + ";\n";
 
 			continue;
 		}
@@ -220,8 +294,8 @@ FString FHLSLMaterialFunctionGenerator::GenerateFunction(
 			bIsOutput,
 			false,
 			DefaultValue,
-			GenerateTooltip(Name, Function.Comment),
-			GenerateMetadata(Metadata)));
+			Signature.ParamDocs.FindRef(Name),
+			Argument.Metadata));
 
 		const FString Error = Pin.ParseTypeAndDefaultValue();
 		if (!Error.IsEmpty())
@@ -229,11 +303,34 @@ FString FHLSLMaterialFunctionGenerator::GenerateFunction(
 			return Error;
 		}
 
+		if (Pin.Metadata.Contains(META_Static) || Pin.Metadata.Contains(META_Dynamic))
+		{
+			if (Pin.FunctionInputType != FunctionInput_StaticBool || bIsOutput || Pin.IsCurrentFramePin())
+			{
+				return "Static & Dynamic metadata can only be used on bool inputs: " + Name;
+			}
+			if (Pin.Metadata.Contains(META_Static) && Pin.Metadata.Contains(META_Dynamic))
+			{
+				return "Cannot be both Static & Dynamic: " + Name;
+			}
+		}
+
+		if (Pin.FunctionInputType == FunctionInput_StaticBool &&
+			!bIsOutput &&
+			!Pin.IsCurrentFramePin() &&
+			(Pin.Metadata.Contains(META_Dynamic) || (Library.bDynamicBools && !Pin.Metadata.Contains(META_Static))))
+		{
+			// Passed as a scalar, and cast back to bool in the Custom node
+			Pin.FunctionInputType = FunctionInput_Scalar;
+			Pin.DefaultValueVector = FVector4(Pin.bDefaultValueBool ? 1.f : 0.f, 0.f, 0.f, 0.f);
+		}
+
 		if (Pin.Metadata.Contains(META_Expose))
 		{
 			switch (Pin.FunctionInputType)
 			{
 			case FunctionInput_Scalar:
+			case FunctionInput_Vector3:
 			case FunctionInput_Vector4:
 			case FunctionInput_Texture2D:
 			case FunctionInput_TextureCube:
@@ -243,588 +340,1425 @@ FString FHLSLMaterialFunctionGenerator::GenerateFunction(
 				break;
 
 			case FunctionInput_Vector2:
-			case FunctionInput_Vector3:
 			case FunctionInput_StaticBool:
 			default:
 				return "Cannot expose type " + Pin.Type + " as a parameter";
 			}
 		}
-	}
 
-	// Detect used texture coordinates
-	int32 MaxTexCoordinateUsed = -1;
-	{
-		FRegexPattern RegexPattern(R"_(Parameters.TexCoords\[([0-9]+)\])_");
-		FRegexMatcher RegexMatcher(RegexPattern, Function.Body);
-		while (RegexMatcher.FindNext())
+		if (Pin.IsTexture())
 		{
-			MaxTexCoordinateUsed = FMath::Max(MaxTexCoordinateUsed, FCString::Atoi(*RegexMatcher.GetCaptureGroup(1)));
-		}
-	}
-
-	// Detect used vertex colors
-	const bool bVertexColorUsed = Function.Body.Contains("Parameters.VertexColor", ESearchCase::CaseSensitive);
-	// Detect whether NEEDS_WORLD_POSITION_EXCLUDING_SHADER_OFFSETS is required
-	const bool bNeedsWorldPositionExcludingShaderOffsets = Function.Body.Contains("GetWorldPosition_NoMaterialOffsets", ESearchCase::CaseSensitive);
-
-	///////////////////////////////////////////////////////////////////////////////////
-	//// Past this point, try to never error out as it'll break existing functions ////
-	///////////////////////////////////////////////////////////////////////////////////
+			// Pin metadata overrides the function one
+			const FString* SamplerName = Pin.Metadata.Find(META_Sampler);
+			if (!SamplerName)
+			{
+				SamplerName = FunctionMetadata.Find(META_Sampler);
+			}
 
-	TMap<FName, FGuid> FunctionInputGuids;
-	TMap<FName, FGuid> FunctionOutputGuids;
-	TMap<FName, FGuid> ParameterGuids;
-	for (UMaterialExpression* Expression : MaterialFunction->FunctionExpressions)
-	{
-		if (UMaterialExpressionFunctionInput* FunctionInput = Cast<UMaterialExpressionFunctionInput>(Expression))
-		{
-			FunctionInputGuids.Add(FunctionInput->InputName, FunctionInput->Id);
+			if (SamplerName && *SamplerName != TEXT("Texture"))
+			{
+				Pin.SharedSampler = GetSharedSampler(*SamplerName);
+				if (Pin.SharedSampler.IsEmpty())
+				{
+					return "Invalid sampler for " + Name + ": " + *SamplerName + ". Valid values are Texture, Wrap, Clamp, BilinearWrap, BilinearClamp, PointWrap and PointClamp";
+				}
+			}
 		}
-		if (UMaterialExpressionFunctionOutput* FunctionOutput = Cast<UMaterialExpressionFunctionOutput>(Expression))
+		else if (Pin.Metadata.Contains(META_Sampler))
 		{
-			FunctionOutputGuids.Add(FunctionOutput->OutputName, FunctionOutput->Id);
+			return "Sampler metadata can only be used on textures: " + Name;
 		}
-		if (UMaterialExpressionParameter* Parameter = Cast<UMaterialExpressionParameter>(Expression))
+
+		if (Pin.Metadata.Contains(META_Interpolate) && !bIsOutput)
 		{
-			ParameterGuids.Add(Parameter->ParameterName, Parameter->ExpressionGUID);
+			return "Interpolate metadata can only be used on outputs: " + Name;
 		}
 	}
-	MaterialFunction->FunctionExpressions.Empty();
-	MaterialFunction->FunctionEditorComments.Empty();
 
+	for (const TCHAR* Key : { FUNC_META_MaxInstructions, FUNC_META_MaxSamplers, FUNC_META_MaxPermutations })
 	{
-		FString Description;
-		Description = Function.Comment
-			.Replace(TEXT("// "), TEXT(""))
-			.Replace(TEXT("\t"), TEXT(" "))
-			.Replace(TEXT("@param "), TEXT(""));
-
-		Description.TrimStartAndEndInline();
-		while (Description.Contains(TEXT("  ")))
-		{
-			Description.ReplaceInline(TEXT("  "), TEXT(" "));
-		}
-		while (Description.Contains(TEXT("\n ")))
-		{
-			Description.ReplaceInline(TEXT("\n "), TEXT("\n"));
-		}
-
-		FString FinalDescription;
-		// Force ConvertToMultilineToolTip(40) to do something nice
-		for (const TCHAR Char : Description)
+		const FString* Budget = FunctionMetadata.Find(Key);
+		// IsNumeric would accept -3 or 1.5. Digits only, and few enough to fit in an int32
+		if (Budget && (Budget->IsEmpty() || Budget->Len() > 9 || !Algo::AllOf(*Budget, [](TCHAR Char) { return FChar::IsDigit(Char); })))
 		{
-			if (Char == TEXT('\n'))
-			{
-				while (FinalDescription.Len() % 41 != 0)
-				{
-					FinalDescription += TEXT(' ');
-				}
-			}
-
-			FinalDescription += Char;
+			return FString::Printf(TEXT("Invalid %s: %s, expected a non-negative integer"), Key, **Budget);
 		}
-
-		MaterialFunction->Description = FinalDescription;
 	}
 
-	MaterialFunction->bExposeToLibrary = true;
-	MaterialFunction->LibraryCategoriesText = Library.Categories;
-
-	ON_SCOPE_EXIT
-	{
-		MaterialFunction->StateId = FGuid::NewGuid();
-		MaterialFunction->MarkPackageDirty();
-	};
-
-	TArray<int32> StaticBoolParameters;
+	TArray<FSelector>& Selectors = OutAnalysis.Selectors;
 	for (int32 Index = 0; Index < Inputs.Num(); Index++)
 	{
-		if (Inputs[Index].FunctionInputType == FunctionInput_StaticBool)
+		if (Inputs[Index].FunctionInputType == FunctionInput_StaticBool && !Inputs[Index].bIsInternal)
 		{
-			StaticBoolParameters.Add(Index);
+			Selectors.Emplace_GetRef().InputIndices.Add(Index);
 		}
 	}
+	Selectors.Append(ValuesSelectors);
 
-	TArray<UMaterialExpression*> FunctionInputs;
-	for (int32 Index = 0; Index < Inputs.Num(); Index++)
+	OutAnalysis.NumPermutations = 1;
+	for (const FSelector& Selector : Selectors)
 	{
-		const FPin& Input = Inputs[Index];
+		OutAnalysis.NumPermutations *= Selector.GetNumValues();
+	}
 
-		if (Input.IsCurrentFramePin())
+	{
+		const FString Error = CheckBudget(Library, Function, FunctionMetadata, FUNC_META_MaxPermutations, OutAnalysis.NumPermutations);
+		if (!Error.IsEmpty())
 		{
-			ensure(Input.FunctionInputType == FunctionInput_StaticBool);
-			FunctionInputs.Add(nullptr);
-			continue;
+			return Error;
 		}
+	}
 
-		if (Input.Metadata.Contains(META_Expose))
+	// Every texture input is counted, even if the body doesn't use it: an upper bound, as the shader compiler strips unused samplers
+	{
+		TSet<FString> Samplers;
+		for (const FPin& Input : Inputs)
 		{
-			const auto SetupExpression = [&](auto* Expression)
-			{
-				FString ParameterName = Input.Name;
-				if (const FString* Prefix = FunctionMetadata.Find(FUNC_META_Prefix))
-				{
-					ParameterName = *Prefix + ParameterName;
-				}
-
-				Expression->MaterialExpressionGuid = FGuid::NewGuid();
-				Expression->ExpressionGUID = ParameterGuids.FindRef(*ParameterName);
-				if (!Expression->ExpressionGUID.IsValid())
-				{
-					Expression->ExpressionGUID = FGuid::NewGuid();
-				}
-				Expression->SortPriority = 32;
-				Expression->ParameterName = *ParameterName;
-				Expression->Group = *Input.Metadata.FindRef(META_Category);
-				Expression->bCollapsed = true;
-				Expression->MaterialExpressionEditorX = 0;
-				Expression->MaterialExpressionEditorY = 200 * Index;
-
-				MaterialFunction->FunctionExpressions.Add(Expression);
-			};
-
-			switch (Input.FunctionInputType)
-			{
-			case FunctionInput_Scalar:
+			if (Input.IsTexture())
 			{
-				UMaterialExpressionScalarParameter* Expression = NewObject<UMaterialExpressionScalarParameter>(MaterialFunction);
-				SetupExpression(Expression);
-
-				FunctionInputs.Add(Expression);
-
-				if (!Input.DefaultValue.IsEmpty())
-				{
-					Expression->DefaultValue = Input.DefaultValueVector.X;
-				}
+				OutAnalysis.NumTextures++;
+				Samplers.Add(Input.SharedSampler.IsEmpty() ? Input.Name : Input.SharedSampler);
 			}
-			break;
-			case FunctionInput_Vector4:
-			{
-				UMaterialExpressionVectorParameter* Expression = NewObject<UMaterialExpressionVectorParameter>(MaterialFunction);
-				SetupExpression(Expression);
-
-				UMaterialExpressionAppendVector* AppendVector = NewObject<UMaterialExpressionAppendVector>(MaterialFunction);
-				MaterialFunction->FunctionExpressions.Add(AppendVector);
-				AppendVector->MaterialExpressionEditorX = 150;
-				AppendVector->MaterialExpressionEditorY = 200 * Index;
-
-				AppendVector->A.Connect(0, Expression);
-				AppendVector->B.Connect(4, Expression);
+		}
 
-				FunctionInputs.Add(AppendVector);
+		OutAnalysis.NumSamplers = Samplers.Num();
 
-				if (!Input.DefaultValue.IsEmpty())
-				{
-					Expression->DefaultValue = FLinearColor(Input.DefaultValueVector);
-				}
-			}
-			break;
-			case FunctionInput_Texture2D:
-			case FunctionInput_TextureCube:
-			case FunctionInput_Texture2DArray:
-			case FunctionInput_VolumeTexture:
-			case FunctionInput_TextureExternal:
-			{
-				UMaterialExpressionTextureObjectParameter* Expression = NewObject<UMaterialExpressionTextureObjectParameter>(MaterialFunction);
-				SetupExpression(Expression);
+		if (OutAnalysis.NumTextures > 0)
+		{
+			UE_LOG(LogHLSLMaterial, Log, TEXT("%s: %d textures, %d samplers"), *Function.Name, OutAnalysis.NumTextures, OutAnalysis.NumSamplers);
+		}
 
-				FunctionInputs.Add(Expression);
+		if (OutAnalysis.NumSamplers > MaxSamplers)
+		{
+			FHLSLMaterialMessages::LogWarningAtLine(
+				Function.DeclarationLine,
+				TEXT("Function %s uses %d samplers, most platforms only support %d. Use [Sampler = Wrap] to share samplers between textures"),
+				*Function.Name,
+				OutAnalysis.NumSamplers,
+				MaxSamplers);
+		}
+	}
 
-				switch (Input.FunctionInputType)
-				{
-				case FunctionInput_Texture2D:
-				{
-					// Default is already a Texture2D
-				}
-				break;
-				case FunctionInput_TextureCube:
-				{
-					Expression->Texture = LoadObject<UTexture>(nullptr, TEXT("/Engine/EngineResources/DefaultTextureCube"));
-				}
-				break;
-				case FunctionInput_Texture2DArray:
-				{
-					// Hacky
+	OutAnalysis.Dependencies = GetDependencies(Function.Body);
 
-					UTexture2DArray* TextureArray = LoadObject<UTexture2DArray>(nullptr, *(BasePath / TEXT("DefaultTextureArray")));
-					if (!TextureArray)
-					{
-						FString Error;
-						TextureArray = CreateAsset<UTexture2DArray>("DefaultTextureArray", BasePath, Error);
-						if (!Error.IsEmpty())
-						{
-							UE_LOG(LogHLSLMaterial, Error, TEXT("Failed to create %s/DefaultTextureArray: %s"), *BasePath, *Error);
-						}
+	return {};
+}
 
-						if (TextureArray)
-						{
-							TextureArray->SourceTextures.Add(LoadObject<UTexture2D>(nullptr, TEXT("/Engine/EngineResources/DefaultTexture_Low.DefaultTexture")));
-						}
-					}
-					Expression->Texture = TextureArray;
-				}
-				break;
-				case FunctionInput_VolumeTexture:
-				{
-					Expression->Texture = LoadObject<UTexture>(nullptr, TEXT("/Engine/EngineResources/DefaultVolumeTexture"));
-				}
-				break;
-				case FunctionInput_TextureExternal:
-				{
-					// No idea what to do here
-				}
-				break;
-				default: check(false);
-				}
-			}
-			break;
-			default: check(false);
-			}
+TArray<FHLSLMaterialCostAnalyzer::FPermutation> FHLSLMaterialFunctionGenerator::GetCostPermutations(const FAnalysis& Analysis)
+{
+	TArray<const FSelector*> Selectors;
+	int32 NumPermutations = 1;
+	for (const FSelector& Selector : Analysis.Selectors)
+	{
+		if (Selector.Name.IsEmpty() && Analysis.Inputs[Selector.InputIndices[0]].IsCurrentFramePin())
+		{
 			continue;
 		}
 
-		UMaterialExpressionFunctionInput* Expression = NewObject<UMaterialExpressionFunctionInput>(MaterialFunction);
-		Expression->MaterialExpressionGuid = FGuid::NewGuid();
-		Expression->Id = FunctionInputGuids.FindRef(*Input.Name);
-		if (!Expression->Id.IsValid())
-		{
-			Expression->Id = FGuid::NewGuid();
-		}
-		Expression->bCollapsed = true;
-		Expression->SortPriority = Index;
-		Expression->InputName = *Input.Name;
-		Expression->InputType = Input.FunctionInputType;
-		Expression->Description = Input.ToolTip;
-		Expression->MaterialExpressionEditorX = 0;
-		Expression->MaterialExpressionEditorY = 200 * Index;
+		Selectors.Add(&Selector);
+		NumPermutations *= Selector.GetNumValues();
+	}
 
-		FunctionInputs.Add(Expression);
-		MaterialFunction->FunctionExpressions.Add(Expression);
+	TArray<FHLSLMaterialCostAnalyzer::FPermutation> Permutations;
+	for (int32 Permutation = 0; Permutation < NumPermutations; Permutation++)
+	{
+		FHLSLMaterialCostAnalyzer::FPermutation& Result = Permutations.Emplace_GetRef();
+		TArray<FString> Names;
 
-		if (!Input.DefaultValue.IsEmpty())
+		// Same order as GetPermutationDeclarations
+		int32 Remainder = Permutation;
+		for (const FSelector* Selector : Selectors)
 		{
-			Expression->bUsePreviewValueAsDefault = true;
-
-			if (!Expression->Description.IsEmpty())
-			{
-				Expression->Description += "\n";
-			}
-			Expression->Description += "Default Value = " + Input.DefaultValue;
-			Expression->InputName = *(Input.Name + " ( = " + Input.DefaultValue + ")");
+			const int32 Value = Remainder % Selector->GetNumValues();
+			Remainder /= Selector->GetNumValues();
 
-			if (Input.FunctionInputType == FunctionInput_StaticBool)
+			if (Selector->Name.IsEmpty())
 			{
-				UMaterialExpressionStaticBool* StaticBool = NewObject<UMaterialExpressionStaticBool>(MaterialFunction);
-				StaticBool->MaterialExpressionGuid = FGuid::NewGuid();
-				StaticBool->MaterialExpressionEditorX = Expression->MaterialExpressionEditorX - 200;
-				StaticBool->MaterialExpressionEditorY = Expression->MaterialExpressionEditorY;
-				StaticBool->Value = Input.bDefaultValueBool;
-				MaterialFunction->FunctionExpressions.Add(StaticBool);
-				Expression->Preview.Connect(0, StaticBool);
+				// 0 is true, as switches take True as first pin
+				const FPin& Input = Analysis.Inputs[Selector->InputIndices[0]];
+				Result.StaticBools.Add(*GetFunctionInputName(Input), Value == 0);
+				Names.Add(Input.Name + "=" + (Value == 0 ? "true" : "false"));
 			}
 			else
 			{
-				Expression->PreviewValue = decltype(Expression->PreviewValue)(Input.DefaultValueVector);
+				// The first value is selected when none of the static bools are set
+				for (int32 Index = 0; Index < Selector->InputIndices.Num(); Index++)
+				{
+					Result.StaticBools.Add(*GetFunctionInputName(Analysis.Inputs[Selector->InputIndices[Index]]), Index + 1 == Value);
+				}
+				Names.Add(Selector->Name + "=" + Selector->Values[Value]);
 			}
 		}
+
+		Result.Name = FString::Join(Names, TEXT(" "));
 	}
 
-	TArray<UMaterialExpressionFunctionOutput*> FunctionOutputs;
-	for (int32 Index = 0; Index < Outputs.Num(); Index++)
-	{
-		const FPin& Output = Outputs[Index];
+	return Permutations;
+}
 
-		UMaterialExpressionFunctionOutput* Expression = NewObject<UMaterialExpressionFunctionOutput>(MaterialFunction);
-		Expression->MaterialExpressionGuid = FGuid::NewGuid();
-		Expression->Id = FunctionOutputGuids.FindRef(*Output.Name);
-		if (!Expression->Id.IsValid())
-		{
-			Expression->Id = FGuid::NewGuid();
-		}
-		Expression->bCollapsed = true;
-		Expression->SortPriority = Index;
-		Expression->OutputName = *Output.Name;
-		Expression->Description = Output.ToolTip;
-		Expression->MaterialExpressionEditorX = (StaticBoolParameters.Num() + 2) * 500;
-		Expression->MaterialExpressionEditorY = 200 * Index;
+FString FHLSLMaterialFunctionGenerator::GenerateFunction(
+	UHLSLMaterialFunctionLibrary& Library,
+	const TArray<FString>& IncludeFilePaths,
+	const TArray<FCustomDefine>& InAdditionalDefines,
+	const TArray<FString>& Structs,
+	FHLSLMaterialFunction Function,
+	bool& bOutUpdated,
+	bool& bOutCodeOnly)
+{
+	bOutUpdated = false;
+	bOutCodeOnly = false;
 
-		FunctionOutputs.Add(Expression);
-		MaterialFunction->FunctionExpressions.Add(Expression);
+	TArray<FCustomDefine> AdditionalDefines = InAdditionalDefines;
+	if (Library.bGenerateShaderFile)
+	{
+		// The Custom nodes only include the shader file: makes sure materials are recompiled when the code this function
+		// can reach changes, even with bCanonicalCode, but not when another function of the file is edited
+		AdditionalDefines.Add({ "HLSL_SHADER_FILE_HASH", FHLSLMaterialUtilities::HashString(Function.HashedString) });
 	}
 
-	struct FOutputPin
+	TSoftObjectPtr<UMaterialFunction>* MaterialFunctionPtr = Library.MaterialFunctions.FindByPredicate([&](TSoftObjectPtr<UMaterialFunction> InFunction)
 	{
-		UMaterialExpression* Expression = nullptr;
-		int32 Index = 0;
-	};
+		return InFunction && InFunction->GetFName() == *Function.Name;
+	});
+	if (!MaterialFunctionPtr)
+	{
+		Library.MarkPackageDirty();
+		MaterialFunctionPtr = &Library.MaterialFunctions.Add_GetRef(nullptr);
+	}
+
+	FString BasePath = FPackageName::ObjectPathToPackageName(Library.GetPathName());
+	if (Library.bPutFunctionsInSubdirectory)
+	{
+		BasePath += "_GeneratedFunctions";
+	}
+	else
+	{
+		BasePath = FPaths::GetPath(BasePath);
+	}
 
-	TArray<TArray<FOutputPin>> AllOutputPins;
-	for (int32 Width = 0; Width < 1 << StaticBoolParameters.Num(); Width++)
+	UMaterialFunction* MaterialFunction = MaterialFunctionPtr->Get();
+	if (!MaterialFunction)
 	{
-		FString LocalVariableDeclarations = VariableDeclarations;
-		for (int32 Index = 0; Index < StaticBoolParameters.Num(); Index++)
+		FString Error;
+		MaterialFunction = CreateAsset<UMaterialFunction>(Function.Name, BasePath, Error);
+
+		if (!Error.IsEmpty())
 		{
-			bool bValue = Width & (1 << Index);
-			// Invert the value, as switches take True as first pin
-			bValue = !bValue;
-			LocalVariableDeclarations += "const bool INTERNAL_IN_" + Inputs[StaticBoolParameters[Index]].Name + " = " + (bValue ? "true" : "false") + ";\n";
+			ensure(!MaterialFunction);
+			return Error;
 		}
-		for (const FPin& Input : Inputs)
+	}
+	if (!MaterialFunction)
+	{
+		return "Failed to create asset";
+	}
+	if (*MaterialFunctionPtr != MaterialFunction)
+	{
+		Library.MarkPackageDirty();
+	}
+	*MaterialFunctionPtr = MaterialFunction;
+
+	for (UMaterialExpressionComment* Comment : MaterialFunction->FunctionEditorComments)
+	{
+		if (Comment && Comment->Text.Contains(Function.HashedString))
 		{
-			if (Input.bIsInternal)
-			{
-				// eg a float4x4 sub-pin
-				continue;
-			}
+			UE_LOG(LogHLSLMaterial, Log, TEXT("%s already up to date"), *Function.Name);
+			return {};
+		}
+	}
 
-			FString Cast;
+	FAnalysis Analysis;
+	{
+		const FString Error = AnalyzeFunction(Library, Function, Analysis);
+		if (!Error.IsEmpty())
+		{
+			return Error;
+		}
+	}
+
+	const FHLSLMaterialSignature& Signature = Analysis.Signature;
+	const TMap<FString, FString>& FunctionMetadata = Signature.Metadata;
+	const TArray<FPin>& Inputs = Analysis.Inputs;
+	const TArray<FPin>& Outputs = Analysis.Outputs;
+	const FString& VariableDeclarations = Analysis.VariableDeclarations;
+	const TArray<FSelector>& Selectors = Analysis.Selectors;
+	const int32 NumPermutations = Analysis.NumPermutations;
+	const TArray<FDependency>& Dependencies = Analysis.Dependencies;
+
+	///////////////////////////////////////////////////////////////////////////////////
+	//// Past this point, try to never error out as it'll break existing functions ////
+	///////////////////////////////////////////////////////////////////////////////////
+
+	const FString SignatureHash = GetSignatureHash(Library, Function, Analysis);
 
-			switch (Input.FunctionInputType)
+	// Most edits only touch the function body: patch the code of the existing Custom nodes instead of rebuilding the graph
+	if (TryUpdateCode(Library, IncludeFilePaths, AdditionalDefines, Structs, Function, Analysis, SignatureHash, *MaterialFunction, bOutUpdated))
+	{
+		bOutCodeOnly = true;
+		// Even if the code is unchanged, as the budgets themselves might have changed
+		return MeasureBudgets(Library, Function, Analysis, *MaterialFunction);
+	}
+
+	FString PreviousGraphState;
+	FString PreviousCommentText;
+	// PostEditChange is called once the graph is built, so that its timing isn't counted twice
+	TArray<UMaterialExpressionCustom*> CustomExpressions;
+	{
+		HLSL_TIMING_SCOPE(BuildGraph, Library, Function.Name);
+
+		TMap<FName, FGuid> FunctionInputGuids;
+		TMap<FName, FGuid> FunctionOutputGuids;
+		TMap<FName, FGuid> ParameterGuids;
+		for (UMaterialExpression* Expression : MaterialFunction->FunctionExpressions)
+		{
+			if (UMaterialExpressionFunctionInput* FunctionInput = Cast<UMaterialExpressionFunctionInput>(Expression))
 			{
-			case FunctionInput_Scalar:
-			case FunctionInput_Vector2:
-			case FunctionInput_Vector3:
-			case FunctionInput_Vector4:
+				FunctionInputGuids.Add(FunctionInput->InputName, FunctionInput->Id);
+			}
+			if (UMaterialExpressionFunctionOutput* FunctionOutput = Cast<UMaterialExpressionFunctionOutput>(Expression))
 			{
-				// Cast float to int if needed
-				Cast = Input.Type;
+				FunctionOutputGuids.Add(FunctionOutput->OutputName, FunctionOutput->Id);
 			}
-			break;
-			case FunctionInput_Texture2D:
-			case FunctionInput_TextureCube:
-			case FunctionInput_Texture2DArray:
-			case FunctionInput_VolumeTexture:
-			case FunctionInput_TextureExternal:
+			if (UMaterialExpressionParameter* Parameter = Cast<UMaterialExpressionParameter>(Expression))
 			{
-				LocalVariableDeclarations += (Input.bIsConst ? "const SamplerState " : "SamplerState ") + Input.Name + "Sampler" + " = INTERNAL_IN_" + Input.Name + "Sampler;\n";
+				ParameterGuids.Add(Parameter->ParameterName, Parameter->ExpressionGUID);
 			}
-			break;
-			case FunctionInput_StaticBool:
-			case FunctionInput_MaterialAttributes:
+		}
+
+		PreviousGraphState = GetGraphState(*MaterialFunction);
+		PreviousCommentText = GetCommentsText(*MaterialFunction);
+
+		// Update the existing expressions in place rather than creating new ones every time
+		FExpressionPool ExpressionPool(*MaterialFunction, GetGuidSeed(Library, Function));
+		MaterialFunction->FunctionExpressions.Empty();
+		MaterialFunction->FunctionEditorComments.Empty();
+
+		{
+			FString Description;
+			Description = Function.Comment
+				.Replace(TEXT("// "), TEXT(""))
+				.Replace(TEXT("\t"), TEXT(" "))
+				.Replace(TEXT("@param "), TEXT(""));
+
+			Description.TrimStartAndEndInline();
+			while (Description.Contains(TEXT("  ")))
 			{
-				// Nothing to fixup
+				Description.ReplaceInline(TEXT("  "), TEXT(" "));
 			}
-			break;
-			case FunctionInput_MAX:
-			default:
-				ensure(false);
+			while (Description.Contains(TEXT("\n ")))
+			{
+				Description.ReplaceInline(TEXT("\n "), TEXT("\n"));
+			}
+
+			FString FinalDescription;
+			// Force ConvertToMultilineToolTip(40) to do something nice
+			for (const TCHAR Char : Description)
+			{
+				if (Char == TEXT('\n'))
+				{
+					while (FinalDescription.Len() % 41 != 0)
+					{
+						FinalDescription += TEXT(' ');
+					}
+				}
+
+				FinalDescription += Char;
 			}
-			LocalVariableDeclarations += (Input.bIsConst ? "const " : "") + Input.Type + " " + Input.Name + " = " + Cast + "(INTERNAL_IN_" + Input.Name + ");\n";
+
+			MaterialFunction->Description = FinalDescription;
 		}
 
-		UMaterialExpressionCustom* MaterialExpressionCustom = NewObject<UMaterialExpressionCustom>(MaterialFunction);
-		MaterialExpressionCustom->MaterialExpressionGuid = FGuid::NewGuid();
-		MaterialExpressionCustom->bCollapsed = true;
-		MaterialExpressionCustom->OutputType = CMOT_Float1;
-		MaterialExpressionCustom->Code = GenerateFunctionCode(Library, Function, Structs, LocalVariableDeclarations);
-		MaterialExpressionCustom->MaterialExpressionEditorX = 500;
-		MaterialExpressionCustom->MaterialExpressionEditorY = 200 * Width;
-		MaterialExpressionCustom->IncludeFilePaths = IncludeFilePaths;
-		MaterialExpressionCustom->AdditionalDefines = AdditionalDefines;
-		MaterialFunction->FunctionExpressions.Add(MaterialExpressionCustom);
+		MaterialFunction->bExposeToLibrary = true;
+		MaterialFunction->LibraryCategoriesText = Library.Categories;
 
-		MaterialExpressionCustom->Inputs.Reset();
+		TArray<UMaterialExpression*> FunctionInputs;
 		for (int32 Index = 0; Index < Inputs.Num(); Index++)
 		{
-			FPin& Input = Inputs[Index];
-			if (Input.FunctionInputType == FunctionInput_StaticBool)
+			const FPin& Input = Inputs[Index];
+
+			if (Input.IsCurrentFramePin())
 			{
+				ensure(Input.FunctionInputType == FunctionInput_StaticBool);
+				FunctionInputs.Add(nullptr);
 				continue;
 			}
 
-			FCustomInput& CustomInput = MaterialExpressionCustom->Inputs.Emplace_GetRef();
-			CustomInput.InputName = *("INTERNAL_IN_" + Input.Name);
-			CustomInput.Input.Connect(0, FunctionInputs[Index]);
+			if (Input.Metadata.Contains(META_Expose))
+			{
+				const auto SetupExpression = [&](auto* Expression)
+				{
+					FString ParameterName = Input.Name;
+					if (const FString* Prefix = FunctionMetadata.Find(FUNC_META_Prefix))
+					{
+						ParameterName = *Prefix + ParameterName;
+					}
+
+					Expression->ExpressionGUID = ParameterGuids.FindRef(*ParameterName);
+					if (!Expression->ExpressionGUID.IsValid())
+					{
+						Expression->ExpressionGUID = ExpressionPool.MakeGuid("ParameterId." + ParameterName);
+					}
+					Expression->SortPriority = 32;
+					Expression->ParameterName = *ParameterName;
+					Expression->Group = *Input.Metadata.FindRef(META_Category);
+					Expression->bCollapsed = true;
+					Expression->MaterialExpressionEditorX = 0;
+					Expression->MaterialExpressionEditorY = 200 * Index;
+
+					MaterialFunction->FunctionExpressions.Add(Expression);
+				};
+
+				switch (Input.FunctionInputType)
+				{
+				case FunctionInput_Scalar:
+				{
+					UMaterialExpressionScalarParameter* Expression = ExpressionPool.New<UMaterialExpressionScalarParameter>("Parameter." + Input.Name);
+					SetupExpression(Expression);
+
+					FunctionInputs.Add(Expression);
+
+					Expression->DefaultValue = GetDefault<UMaterialExpressionScalarParameter>()->DefaultValue;
+					if (!Input.DefaultValue.IsEmpty())
+					{
+						Expression->DefaultValue = Input.DefaultValueVector.X;
+					}
+				}
+				break;
+				case FunctionInput_Vector3:
+				{
+					UMaterialExpressionVectorParameter* Expression = ExpressionPool.New<UMaterialExpressionVectorParameter>("Parameter." + Input.Name);
+					SetupExpression(Expression);
+
+					// First output is RGB
+					FunctionInputs.Add(Expression);
+
+					Expression->DefaultValue = GetDefault<UMaterialExpressionVectorParameter>()->DefaultValue;
+					if (!Input.DefaultValue.IsEmpty())
+					{
+						Expression->DefaultValue = FLinearColor(Input.DefaultValueVector);
+					}
+				}
+				break;
+				case FunctionInput_Vector4:
+				{
+					UMaterialExpressionVectorParameter* Expression = ExpressionPool.New<UMaterialExpressionVectorParameter>("Parameter." + Input.Name);
+					SetupExpression(Expression);
+
+					UMaterialExpressionAppendVector* AppendVector = ExpressionPool.New<UMaterialExpressionAppendVector>("Append." + Input.Name);
+					MaterialFunction->FunctionExpressions.Add(AppendVector);
+					AppendVector->MaterialExpressionEditorX = 150;
+					AppendVector->MaterialExpressionEditorY = 200 * Index;
+
+					AppendVector->A.Connect(0, Expression);
+					AppendVector->B.Connect(4, Expression);
+
+					FunctionInputs.Add(AppendVector);
+
+					Expression->DefaultValue = GetDefault<UMaterialExpressionVectorParameter>()->DefaultValue;
+					if (!Input.DefaultValue.IsEmpty())
+					{
+						Expression->DefaultValue = FLinearColor(Input.DefaultValueVector);
+					}
+				}
+				break;
+				case FunctionInput_Texture2D:
+				case FunctionInput_TextureCube:
+				case FunctionInput_Texture2DArray:
+				case FunctionInput_VolumeTexture:
+				case FunctionInput_TextureExternal:
+				{
+					UMaterialExpressionTextureObjectParameter* Expression = ExpressionPool.New<UMaterialExpressionTextureObjectParameter>("Parameter." + Input.Name);
+					SetupExpression(Expression);
+
+					FunctionInputs.Add(Expression);
+
+					Expression->Texture = GetDefault<UMaterialExpressionTextureObjectParameter>()->Texture;
+
+					switch (Input.FunctionInputType)
+					{
+					case FunctionInput_Texture2D:
+					{
+						// Default is already a Texture2D
+					}
+					break;
+					case FunctionInput_TextureCube:
+					{
+						Expression->Texture = LoadObject<UTexture>(nullptr, TEXT("/Engine/EngineResources/DefaultTextureCube"));
+					}
+					break;
+					case FunctionInput_Texture2DArray:
+					{
+						// Hacky
+
+						UTexture2DArray* TextureArray = LoadObject<UTexture2DArray>(nullptr, *(BasePath / TEXT("DefaultTextureArray")));
+						if (!TextureArray)
+						{
+							FString Error;
+							TextureArray = CreateAsset<UTexture2DArray>("DefaultTextureArray", BasePath, Error);
+							if (!Error.IsEmpty())
+							{
+								UE_LOG(LogHLSLMaterial, Error, TEXT("Failed to create %s/DefaultTextureArray: %s"), *BasePath, *Error);
+							}
+
+							if (TextureArray)
+							{
+								TextureArray->SourceTextures.Add(LoadObject<UTexture2D>(nullptr, TEXT("/Engine/EngineResources/DefaultTexture_Low.DefaultTexture")));
+							}
+						}
+						Expression->Texture = TextureArray;
+					}
+					break;
+					case FunctionInput_VolumeTexture:
+					{
+						Expression->Texture = LoadObject<UTexture>(nullptr, TEXT("/Engine/EngineResources/DefaultVolumeTexture"));
+					}
+					break;
+					case FunctionInput_TextureExternal:
+					{
+						// No idea what to do here
+					}
+					break;
+					default: check(false);
+					}
+				}
+				break;
+				default: check(false);
+				}
+				continue;
+			}
+
+			const FString InputName = Input.DisplayName.IsEmpty() ? Input.Name : Input.DisplayName;
+
+			UMaterialExpressionFunctionInput* Expression = ExpressionPool.New<UMaterialExpressionFunctionInput>("Input." + Input.Name);
+			Expression->Id = FunctionInputGuids.FindRef(*InputName);
+			if (!Expression->Id.IsValid())
+			{
+				Expression->Id = ExpressionPool.MakeGuid("InputId." + Input.Name);
+			}
+			Expression->bCollapsed = true;
+			Expression->SortPriority = Index;
+			Expression->InputName = *InputName;
+			Expression->InputType = Input.FunctionInputType;
+			Expression->Description = Input.ToolTip;
+			Expression->MaterialExpressionEditorX = 0;
+			Expression->MaterialExpressionEditorY = 200 * Index;
+			Expression->bUsePreviewValueAsDefault = false;
+			Expression->PreviewValue = GetDefault<UMaterialExpressionFunctionInput>()->PreviewValue;
+
+			FunctionInputs.Add(Expression);
+			MaterialFunction->FunctionExpressions.Add(Expression);
+
+			if (!Input.DefaultValue.IsEmpty())
+			{
+				Expression->bUsePreviewValueAsDefault = true;
+
+				if (!Expression->Description.IsEmpty())
+				{
+					Expression->Description += "\n";
+				}
+				Expression->Description += "Default Value = " + Input.DefaultValue;
+				Expression->InputName = *GetFunctionInputName(Input);
+
+				if (Input.FunctionInputType == FunctionInput_StaticBool)
+				{
+					UMaterialExpressionStaticBool* StaticBool = ExpressionPool.New<UMaterialExpressionStaticBool>("StaticBool." + Input.Name);
+					StaticBool->MaterialExpressionEditorX = Expression->MaterialExpressionEditorX - 200;
+					StaticBool->MaterialExpressionEditorY = Expression->MaterialExpressionEditorY;
+					StaticBool->Value = Input.bDefaultValueBool;
+					MaterialFunction->FunctionExpressions.Add(StaticBool);
+					Expression->Preview.Connect(0, StaticBool);
+				}
+				else
+				{
+					Expression->PreviewValue = decltype(Expression->PreviewValue)(Input.DefaultValueVector);
+				}
+			}
 		}
+
+		TArray<UMaterialExpressionFunctionOutput*> FunctionOutputs;
 		for (int32 Index = 0; Index < Outputs.Num(); Index++)
 		{
 			const FPin& Output = Outputs[Index];
-			MaterialExpressionCustom->AdditionalOutputs.Add({ *Output.Name, Output.CustomOutputType.GetValue() });
+
+			UMaterialExpressionFunctionOutput* Expression = ExpressionPool.New<UMaterialExpressionFunctionOutput>("Output." + Output.Name);
+			Expression->Id = FunctionOutputGuids.FindRef(*Output.Name);
+			if (!Expression->Id.IsValid())
+			{
+				Expression->Id = ExpressionPool.MakeGuid("OutputId." + Output.Name);
+			}
+			Expression->bCollapsed = true;
+			Expression->SortPriority = Index;
+			Expression->OutputName = *Output.Name;
+			Expression->Description = Output.ToolTip;
+			Expression->MaterialExpressionEditorX = (Selectors.Num() + 2) * 500;
+			Expression->MaterialExpressionEditorY = 200 * Index;
+
+			FunctionOutputs.Add(Expression);
+			MaterialFunction->FunctionExpressions.Add(Expression);
+		}
+
+		struct FOutputPin
+		{
+			UMaterialExpression* Expression = nullptr;
+			int32 Index = 0;
+		};
+
+		// Shared by all the permutations, to only request each interpolator once
+		TArray<UMaterialExpression*> DependencyExpressions;
+		for (int32 Index = 0; Index < Dependencies.Num(); Index++)
+		{
+			const FDependency& Dependency = Dependencies[Index];
+
+			UMaterialExpression* Expression = ExpressionPool.New(Dependency.Class, "Dependency." + Dependency.Name);
+			Expression->bCollapsed = true;
+			Expression->MaterialExpressionEditorX = 300;
+			Expression->MaterialExpressionEditorY = -100 * (Index + 1);
+
+			if (UMaterialExpressionTextureCoordinate* TextureCoordinate = Cast<UMaterialExpressionTextureCoordinate>(Expression))
+			{
+				TextureCoordinate->CoordinateIndex = Dependency.Index;
+			}
+			else if (UMaterialExpressionDynamicParameter* DynamicParameter = Cast<UMaterialExpressionDynamicParameter>(Expression))
+			{
+				DynamicParameter->ParameterIndex = Dependency.Index;
+			}
+			else if (UMaterialExpressionWorldPosition* WorldPosition = Cast<UMaterialExpressionWorldPosition>(Expression))
+			{
+				WorldPosition->WorldPositionShaderOffset = WPT_ExcludeAllShaderOffsets;
+			}
+
+			MaterialFunction->FunctionExpressions.Add(Expression);
+			DependencyExpressions.Add(Expression);
 		}
 
-		if (MaxTexCoordinateUsed != -1)
+		TArray<TArray<FOutputPin>> AllOutputPins;
+		for (int32 Width = 0; Width < NumPermutations; Width++)
 		{
-			// Create a dummy texture coordinate index to ensure NUM_TEX_COORD_INTERPOLATORS is correct
+			const FString LocalVariableDeclarations = GetPermutationDeclarations(Analysis, Width);
+
+			UMaterialExpressionCustom* MaterialExpressionCustom = ExpressionPool.New<UMaterialExpressionCustom>("Custom." + FString::FromInt(Width));
+			MaterialExpressionCustom->bCollapsed = true;
+			MaterialExpressionCustom->OutputType = CMOT_Float1;
+			MaterialExpressionCustom->Code = GenerateFunctionCode(Library, Function, Signature, Structs, LocalVariableDeclarations);
+			MaterialExpressionCustom->MaterialExpressionEditorX = 500;
+			MaterialExpressionCustom->MaterialExpressionEditorY = 200 * Width;
+			MaterialExpressionCustom->IncludeFilePaths = IncludeFilePaths;
+			MaterialExpressionCustom->AdditionalDefines = AdditionalDefines;
+			MaterialFunction->FunctionExpressions.Add(MaterialExpressionCustom);
+
+			MaterialExpressionCustom->Inputs.Reset();
+			for (int32 Index = 0; Index < Inputs.Num(); Index++)
+			{
+				const FPin& Input = Inputs[Index];
+				if (Input.FunctionInputType == FunctionInput_StaticBool)
+				{
+					continue;
+				}
+
+				FCustomInput& CustomInput = MaterialExpressionCustom->Inputs.Emplace_GetRef();
+				CustomInput.InputName = *("INTERNAL_IN_" + Input.Name);
+				CustomInput.Input.Connect(0, FunctionInputs[Index]);
+			}
+			MaterialExpressionCustom->AdditionalOutputs.Reset();
+			for (int32 Index = 0; Index < Outputs.Num(); Index++)
+			{
+				const FPin& Output = Outputs[Index];
+				MaterialExpressionCustom->AdditionalOutputs.Add({ *Output.Name, Output.CustomOutputType.GetValue() });
+			}
+
+			for (int32 Index = 0; Index < Dependencies.Num(); Index++)
+			{
+				FCustomInput& CustomInput = MaterialExpressionCustom->Inputs.Emplace_GetRef();
+				CustomInput.InputName = *("DUMMY_" + Dependencies[Index].Name + "_INPUT");
+				CustomInput.Input.Connect(0, DependencyExpressions[Index]);
+			}
 
-			UMaterialExpressionTextureCoordinate* TextureCoordinate = NewObject<UMaterialExpressionTextureCoordinate>(MaterialFunction);
-			TextureCoordinate->MaterialExpressionGuid = FGuid::NewGuid();
-			TextureCoordinate->bCollapsed = true;
-			TextureCoordinate->CoordinateIndex = MaxTexCoordinateUsed;
-			TextureCoordinate->MaterialExpressionEditorX = MaterialExpressionCustom->MaterialExpressionEditorX - 200;
-			TextureCoordinate->MaterialExpressionEditorY = MaterialExpressionCustom->MaterialExpressionEditorY;
-			MaterialFunction->FunctionExpressions.Add(TextureCoordinate);
+			CustomExpressions.Add(MaterialExpressionCustom);
 
-			FCustomInput& CustomInput = MaterialExpressionCustom->Inputs.Emplace_GetRef();
-			CustomInput.InputName = "DUMMY_COORDINATE_INPUT";
-			CustomInput.Input.Connect(0, TextureCoordinate);
+			TArray<FOutputPin>& OutputPins = AllOutputPins.Emplace_GetRef();
+			for (int32 Index = 0; Index < Outputs.Num(); Index++)
+			{
+				// + 1 as default output pin is result
+				OutputPins.Add({ MaterialExpressionCustom, Index + 1 });
+			}
 		}
 
-		if (bVertexColorUsed)
+		for (int32 Layer = 0; Layer < Selectors.Num(); Layer++)
 		{
-			// Create a dummy vertex color parameter to ensure INTERPOLATE_VERTEX_COLOR is correct
+			const FSelector& Selector = Selectors[Layer];
+			const int32 NumValues = Selector.GetNumValues();
+
+			const TArray<TArray<FOutputPin>> PreviousAllOutputPins = MoveTemp(AllOutputPins);
+
+			for (int32 Width = 0; Width < PreviousAllOutputPins.Num() / NumValues; Width++)
+			{
+				TArray<FOutputPin>& OutputPins = AllOutputPins.Emplace_GetRef();
+				for (int32 Index = 0; Index < Outputs.Num(); Index++)
+				{
+					// Bools: True ? 0 : 1
+					// [Values] pins: a chain of switches, eg Mode = B ? B : Mode = C ? C : A
+					FOutputPin OutputPin = PreviousAllOutputPins[NumValues * Width + (Selector.Name.IsEmpty() ? 1 : 0)][Index];
+
+					for (int32 SwitchIndex = Selector.InputIndices.Num() - 1; SwitchIndex >= 0; SwitchIndex--)
+					{
+						const int32 InputIndex = Selector.InputIndices[SwitchIndex];
+						const FPin& Input = Inputs[InputIndex];
+
+						UClass* Class = UMaterialExpressionStaticSwitch::StaticClass();
+						if (Input.IsCurrentFramePin())
+						{
+							Class = UMaterialExpressionPreviousFrameSwitch::StaticClass();
+						}
+
+						FString Role = FString::Printf(TEXT("Switch.%d.%d.%d"), Layer, Width, Index);
+						if (!Selector.Name.IsEmpty())
+						{
+							Role += "." + FString::FromInt(SwitchIndex);
+						}
+
+						UMaterialExpression* StaticSwitch = ExpressionPool.New(Class, Role);
+						StaticSwitch->MaterialExpressionEditorX = (Layer + 2) * 500;
+						StaticSwitch->MaterialExpressionEditorY = 200 * Width + 50 * SwitchIndex;
+						MaterialFunction->FunctionExpressions.Add(StaticSwitch);
+
+						const FOutputPin& TrueOutputPin = PreviousAllOutputPins[NumValues * Width + (Selector.Name.IsEmpty() ? 0 : SwitchIndex + 1)][Index];
 
-			UMaterialExpressionVertexColor* Color = NewObject<UMaterialExpressionVertexColor>(MaterialFunction);
-			Color->MaterialExpressionGuid = FGuid::NewGuid();
-			Color->bCollapsed = true;
-			Color->MaterialExpressionEditorX = MaterialExpressionCustom->MaterialExpressionEditorX - 200;
-			Color->MaterialExpressionEditorY = MaterialExpressionCustom->MaterialExpressionEditorY;
-			MaterialFunction->FunctionExpressions.Add(Color);
+						StaticSwitch->GetInput(0)->Connect(TrueOutputPin.Index, TrueOutputPin.Expression);
+						StaticSwitch->GetInput(1)->Connect(OutputPin.Index, OutputPin.Expression);
 
-			FCustomInput& CustomInput = MaterialExpressionCustom->Inputs.Emplace_GetRef();
-			CustomInput.InputName = "DUMMY_COLOR_INPUT";
-			CustomInput.Input.Connect(0, Color);
+						if (!Input.IsCurrentFramePin())
+						{
+							StaticSwitch->GetInput(2)->Connect(0, FunctionInputs[InputIndex]);
+						}
+
+						OutputPin = { StaticSwitch, 0 };
+					}
+
+					OutputPins.Add(OutputPin);
+				}
+			}
 		}
 
-		if (bNeedsWorldPositionExcludingShaderOffsets)
+		ensure(AllOutputPins.Num() == 1);
+		for (int32 Index = 0; Index < Outputs.Num(); Index++)
 		{
-			// Create a dummy world position node to ensure NEEDS_WORLD_POSITION_EXCLUDING_SHADER_OFFSETS is correct
+			const FOutputPin& Pin = AllOutputPins[0][Index];
+			UMaterialExpressionFunctionOutput* FunctionOutput = FunctionOutputs[Index];
 
-			UMaterialExpressionWorldPosition* WorldPosition = NewObject<UMaterialExpressionWorldPosition>(MaterialFunction);
-			WorldPosition->MaterialExpressionGuid = FGuid::NewGuid();
-			WorldPosition->bCollapsed = true;
-			WorldPosition->WorldPositionShaderOffset = WPT_ExcludeAllShaderOffsets;
-			WorldPosition->MaterialExpressionEditorX = MaterialExpressionCustom->MaterialExpressionEditorX - 200;
-			WorldPosition->MaterialExpressionEditorY = MaterialExpressionCustom->MaterialExpressionEditorY;
-			MaterialFunction->FunctionExpressions.Add(WorldPosition);
+			// Add multiply node to mitigate 5.0 bug where custom node output are incorrectly translated if linked directly to a material output
+			UMaterialExpressionMultiply* Multiply = ExpressionPool.New<UMaterialExpressionMultiply>("Multiply." + Outputs[Index].Name);
+			Multiply->MaterialExpressionEditorX = FunctionOutput->MaterialExpressionEditorX - 50;
+			Multiply->MaterialExpressionEditorY = FunctionOutput->MaterialExpressionEditorY;
+			MaterialFunction->FunctionExpressions.Add(Multiply);
 
-			FCustomInput& CustomInput = MaterialExpressionCustom->Inputs.Emplace_GetRef();
-			CustomInput.InputName = "DUMMY_WORLD_POSITION_INPUT";
-			CustomInput.Input.Connect(0, WorldPosition);
+			if (Outputs[Index].IsInterpolated())
+			{
+				// The Custom node is compiled in the vertex shader for this output, and the pixel shader only reads the interpolated value
+				// The pixel shader Custom node still writes this output, but it's unused there & stripped by the shader compiler
+				UMaterialExpressionVertexInterpolator* VertexInterpolator = ExpressionPool.New<UMaterialExpressionVertexInterpolator>("Interpolator." + Outputs[Index].Name);
+				VertexInterpolator->MaterialExpressionEditorX = Multiply->MaterialExpressionEditorX - 150;
+				VertexInterpolator->MaterialExpressionEditorY = Multiply->MaterialExpressionEditorY;
+				MaterialFunction->FunctionExpressions.Add(VertexInterpolator);
+
+				VertexInterpolator->Input.Connect(Pin.Index, Pin.Expression);
+				Multiply->GetInput(0)->Connect(0, VertexInterpolator);
+			}
+			else
+			{
+				Multiply->GetInput(0)->Connect(Pin.Index, Pin.Expression);
+			}
+			FunctionOutput->GetInput(0)->Connect(0, Multiply);
+		}
+
+		{
+			UMaterialExpressionComment* Comment = ExpressionPool.New<UMaterialExpressionComment>("Comment");
+			Comment->MaterialExpressionEditorX = 0;
+			Comment->MaterialExpressionEditorY = -200;
+			Comment->SizeX = 1000;
+			Comment->SizeY = 100;
+			Comment->Text = GetCommentText(Library, Function, SignatureHash);
+			MaterialFunction->FunctionEditorComments.Add(Comment);
 		}
 
+		UE_LOG(LogHLSLMaterial, Verbose, TEXT("%s: %d expressions reused, %d created"), *Function.Name, ExpressionPool.GetNumReused(), ExpressionPool.GetNumCreated());
+	}
+
+	for (UMaterialExpressionCustom* MaterialExpressionCustom : CustomExpressions)
+	{
+		HLSL_TIMING_SCOPE(PostEditChange, Library, Function.Name);
 		MaterialExpressionCustom->PostEditChange();
+	}
 
-		TArray<FOutputPin>& OutputPins = AllOutputPins.Emplace_GetRef();
-		for (int32 Index = 0; Index < Outputs.Num(); Index++)
+	const FString GraphState = GetGraphState(*MaterialFunction);
+	if (GraphState == PreviousGraphState)
+	{
+		// Don't invalidate the materials using it, eg if only comments changed
+		UE_LOG(LogHLSLMaterial, Log, TEXT("%s: generated graph is unchanged"), *Function.Name);
+
+		if (GetCommentsText(*MaterialFunction) != PreviousCommentText)
 		{
-			// + 1 as default output pin is result
-			OutputPins.Add({ MaterialExpressionCustom, Index + 1 });
+			// Save the new hash, otherwise the function would be considered outdated in the next sessions
+			MaterialFunction->MarkPackageDirty();
+		}
+
+		// The budgets themselves might have changed
+		return MeasureBudgets(Library, Function, Analysis, *MaterialFunction);
+	}
+
+	// Deterministic, so that regenerating the same graph gives the same asset
+	MaterialFunction->StateId = FHLSLMaterialUtilities::HashStringToGuid(GraphState);
+	MaterialFunction->MarkPackageDirty();
+	bOutUpdated = true;
+
+	return MeasureBudgets(Library, Function, Analysis, *MaterialFunction);
+}
+
+bool FHLSLMaterialFunctionGenerator::TryUpdateCode(
+	const UHLSLMaterialFunctionLibrary& Library,
+	const TArray<FString>& IncludeFilePaths,
+	const TArray<FCustomDefine>& AdditionalDefines,
+	const TArray<FString>& Structs,
+	const FHLSLMaterialFunction& Function,
+	const FAnalysis& Analysis,
+	const FString& SignatureHash,
+	UMaterialFunction& MaterialFunction,
+	bool& bOutUpdated)
+{
+	UMaterialExpressionComment* HashComment = nullptr;
+	for (UMaterialExpressionComment* Comment : MaterialFunction.FunctionEditorComments)
+	{
+		if (Comment && Comment->Text.Contains(SignatureHash))
+		{
+			HashComment = Comment;
+		}
+	}
+	if (!HashComment)
+	{
+		// Pins, metadata or dependencies changed, or the asset predates signature hashes
+		return false;
+	}
+
+	TMap<FGuid, UMaterialExpressionCustom*> CustomNodes;
+	for (UMaterialExpression* Expression : MaterialFunction.FunctionExpressions)
+	{
+		if (UMaterialExpressionCustom* CustomNode = Cast<UMaterialExpressionCustom>(Expression))
+		{
+			CustomNodes.Add(CustomNode->MaterialExpressionGuid, CustomNode);
+		}
+	}
+
+	// Same roles as when building the graph
+	const FString GuidSeed = GetGuidSeed(Library, Function);
+
+	TArray<UMaterialExpressionCustom*> PermutationNodes;
+	for (int32 Permutation = 0; Permutation < Analysis.NumPermutations; Permutation++)
+	{
+		UMaterialExpressionCustom* CustomNode = CustomNodes.FindRef(FExpressionPool::MakeGuid(GuidSeed, "Custom." + FString::FromInt(Permutation)));
+		if (!CustomNode)
+		{
+			// Asset was modified manually
+			return false;
+		}
+		PermutationNodes.Add(CustomNode);
+	}
+
+	HLSL_TIMING_SCOPE(UpdateCode, Library, Function.Name);
+
+	const FString PreviousGraphState = GetGraphState(MaterialFunction);
+
+	for (int32 Permutation = 0; Permutation < Analysis.NumPermutations; Permutation++)
+	{
+		UMaterialExpressionCustom* CustomNode = PermutationNodes[Permutation];
+		CustomNode->Code = GenerateFunctionCode(Library, Function, Analysis.Signature, Structs, GetPermutationDeclarations(Analysis, Permutation));
+		CustomNode->IncludeFilePaths = IncludeFilePaths;
+		CustomNode->AdditionalDefines = AdditionalDefines;
+	}
+
+	const FString CommentText = GetCommentText(Library, Function, SignatureHash);
+	const bool bCommentChanged = HashComment->Text != CommentText;
+	HashComment->Text = CommentText;
+
+	const FString GraphState = GetGraphState(MaterialFunction);
+	if (GraphState == PreviousGraphState)
+	{
+		UE_LOG(LogHLSLMaterial, Log, TEXT("%s: generated code is unchanged"), *Function.Name);
+
+		if (bCommentChanged)
+		{
+			// Save the new hash, otherwise the function would be considered outdated in the next sessions
+			MaterialFunction.MarkPackageDirty();
+		}
+		return true;
+	}
+
+	UE_LOG(LogHLSLMaterial, Log, TEXT("%s: updated the code of %d Custom nodes"), *Function.Name, PermutationNodes.Num());
+
+	MaterialFunction.StateId = FHLSLMaterialUtilities::HashStringToGuid(GraphState);
+	MaterialFunction.MarkPackageDirty();
+	bOutUpdated = true;
+
+	return true;
+}
+
+TMap<FObjectKey, FHLSLMaterialFunctionGenerator::FMeasuredCost> FHLSLMaterialFunctionGenerator::MeasuredCosts;
+
+FString FHLSLMaterialFunctionGenerator::MeasureBudgets(const UHLSLMaterialFunctionLibrary& Library, const FHLSLMaterialFunction& Function, const FAnalysis& Analysis, UMaterialFunction& MaterialFunction)
+{
+	const TMap<FString, FString>& FunctionMetadata = Analysis.Signature.Metadata;
+
+	if (!FunctionMetadata.Contains(FUNC_META_MaxInstructions) &&
+		!FunctionMetadata.Contains(FUNC_META_MaxSamplers))
+	{
+		return {};
+	}
+
+	const FMeasuredCost* MeasuredCost = MeasuredCosts.Find(&MaterialFunction);
+	if (!MeasuredCost ||
+		MeasuredCost->StateId != MaterialFunction.StateId ||
+		MeasuredCost->HashedString != Function.HashedString)
+	{
+		HLSL_TIMING_SCOPE(MeasureCost, Library, Function.Name);
+
+		TArray<FHLSLMaterialCostAnalyzer::FCost> Costs;
+		const FString Error = FHLSLMaterialCostAnalyzer::Measure(MaterialFunction, GMaxRHIShaderPlatform, GetCostPermutations(Analysis), Costs);
+		if (!Error.IsEmpty())
+		{
+			MeasuredCosts.Remove(&MaterialFunction);
+			FHLSLMaterialMessages::ShowError(TEXT("Function %s: failed to measure cost: %s"), *Function.Name, *Error);
+			return {};
+		}
+
+		// Budgets apply to the most expensive permutation
+		FMeasuredCost NewMeasuredCost;
+		NewMeasuredCost.StateId = MaterialFunction.StateId;
+		NewMeasuredCost.HashedString = Function.HashedString;
+		for (const FHLSLMaterialCostAnalyzer::FCost& Cost : Costs)
+		{
+			NewMeasuredCost.NumInstructions = FMath::Max(NewMeasuredCost.NumInstructions, FMath::Max(Cost.NumVertexInstructions, Cost.NumPixelInstructions));
+			NewMeasuredCost.NumSamplers = FMath::Max(NewMeasuredCost.NumSamplers, Cost.NumSamplers);
+		}
+		MeasuredCost = &MeasuredCosts.Add(&MaterialFunction, NewMeasuredCost);
+	}
+	else
+	{
+		UE_LOG(LogHLSLMaterial, Verbose, TEXT("%s: generated code is unchanged, reusing the measured cost"), *Function.Name);
+	}
+
+	// Checked every time, as the budgets themselves might have changed
+	const FString BudgetError = CheckBudget(Library, Function, FunctionMetadata, FUNC_META_MaxInstructions, MeasuredCost->NumInstructions);
+	if (!BudgetError.IsEmpty())
+	{
+		return BudgetError;
+	}
+	return CheckBudget(Library, Function, FunctionMetadata, FUNC_META_MaxSamplers, MeasuredCost->NumSamplers);
+}
+
+FString FHLSLMaterialFunctionGenerator::GetSignatureHash(const UHLSLMaterialFunctionLibrary& Library, const FHLSLMaterialFunction& Function, const FAnalysis& Analysis)
+{
+	// Everything the graph depends on, except the Custom nodes code, includes & defines
+	FString Text =
+		Library.GetPathName() + " " +
+		Library.File.FilePath + " " +
+		(Library.bDynamicBools ? "DynamicBools " : "") +
+		(Library.bGenerateShaderFile ? "ShaderFile " : "") +
+		Function.Comment + " " +
+		Function.Metadata + " " +
+		Function.ReturnType + " " +
+		Function.Name + "(" +
+		FString::Join(Function.Arguments, TEXT(",")) + ")";
+
+	for (const FText& Category : Library.Categories)
+	{
+		Text += " " + Category.ToString();
+	}
+	for (const FDependency& Dependency : Analysis.Dependencies)
+	{
+		Text += FString::Printf(TEXT(" %s%d"), *Dependency.Name, Dependency.Index);
+	}
+
+	return "HLSL Signature Hash: " + FHLSLMaterialUtilities::HashString(Text);
+}
+
+FString FHLSLMaterialFunctionGenerator::GetCommentText(const UHLSLMaterialFunctionLibrary& Library, const FHLSLMaterialFunction& Function, const FString& SignatureHash)
+{
+	return "DO NOT MODIFY THIS\nAutogenerated from " + Library.File.FilePath + "\nLibrary " + Library.GetPathName() + "\n" + Function.HashedString + "\n" + SignatureHash;
+}
+
+FString FHLSLMaterialFunctionGenerator::GetGuidSeed(const UHLSLMaterialFunctionLibrary& Library, const FHLSLMaterialFunction& Function)
+{
+	return Library.GetPathName() + "." + Function.Name;
+}
+
+FString FHLSLMaterialFunctionGenerator::GetFunctionInputName(const FPin& Input)
+{
+	const FString InputName = Input.DisplayName.IsEmpty() ? Input.Name : Input.DisplayName;
+	if (Input.DefaultValue.IsEmpty())
+	{
+		return InputName;
+	}
+	return InputName + " ( = " + Input.DefaultValue + ")";
+}
+
+FString FHLSLMaterialFunctionGenerator::GetPermutationDeclarations(const FAnalysis& Analysis, int32 Permutation)
+{
+	FString LocalVariableDeclarations = Analysis.VariableDeclarations;
+
+	// Mixed radix: the first selector is the least significant digit
+	int32 Remainder = Permutation;
+	for (const FSelector& Selector : Analysis.Selectors)
+	{
+		const int32 Value = Remainder % Selector.GetNumValues();
+		Remainder /= Selector.GetNumValues();
+
+		if (Selector.Name.IsEmpty())
+		{
+			// 0 is true, as switches take True as first pin
+			LocalVariableDeclarations += "const bool INTERNAL_IN_" + Analysis.Inputs[Selector.InputIndices[0]].Name + " = " + (Value == 0 ? "true" : "false") + ";\n";
+		}
+		else
+		{
+			LocalVariableDeclarations += FString(Selector.bIsConst ? "const " : "") + Selector.Type + " " + Selector.Name + " = " + FString::FromInt(Value) + ";\n";
+		}
+	}
+	for (const FPin& Input : Analysis.Inputs)
+	{
+		if (Input.bIsInternal)
+		{
+			// eg a matrix sub-pin
+			continue;
+		}
+
+		FString Cast;
+
+		switch (Input.FunctionInputType)
+		{
+		case FunctionInput_Scalar:
+		case FunctionInput_Vector2:
+		case FunctionInput_Vector3:
+		case FunctionInput_Vector4:
+		{
+			// Cast float to int if needed
+			Cast = Input.Type;
+		}
+		break;
+		case FunctionInput_Texture2D:
+		case FunctionInput_TextureCube:
+		case FunctionInput_Texture2DArray:
+		case FunctionInput_VolumeTexture:
+		case FunctionInput_TextureExternal:
+		{
+			FString Sampler = "INTERNAL_IN_" + Input.Name + "Sampler";
+			if (!Input.SharedSampler.IsEmpty())
+			{
+				// Falls back to the texture sampler on platforms that don't support independent samplers
+				Sampler = "GetMaterialSharedSampler(" + Sampler + ", " + Input.SharedSampler + ")";
+			}
+			LocalVariableDeclarations += (Input.bIsConst ? "const SamplerState " : "SamplerState ") + Input.Name + "Sampler" + " = " + Sampler + ";\n";
+		}
+		break;
+		case FunctionInput_StaticBool:
+		case FunctionInput_MaterialAttributes:
+		{
+			// Nothing to fixup
+		}
+		break;
+		case FunctionInput_MAX:
+		default:
+			ensure(false);
+		}
+		LocalVariableDeclarations += (Input.bIsConst ? "const " : "") + Input.Type + " " + Input.Name + " = " + Cast + "(INTERNAL_IN_" + Input.Name + ");\n";
+	}
+
+	return LocalVariableDeclarations;
+}
+
+void FHLSLMaterialFunctionGenerator::RefreshMaterialEditors(const UHLSLMaterialFunctionLibrary& Library, FMaterialUpdateContext& UpdateContext, bool bRebuildGraphs)
+{
+	HLSL_TIMING_SCOPE(RefreshEditors, Library);
+
+	// Only compile the preview feature level while iterating
+	const FHLSLMaterialPreviewCompilation::FScope PreviewCompilationScope;
+
+	// Update open material editors
+	for (TObjectIterator<UMaterial> It; It; ++It)
+	{
+		UMaterial* CurrentMaterial = *It;
+		if (!CurrentMaterial->bIsPreviewMaterial)
+		{
+			continue;
+		}
+
+		IMaterialEditor* MaterialEditor = FindMaterialEditorForAsset(CurrentMaterial);
+		if (!MaterialEditor)
+		{
+			continue;
+		}
+
+		UpdateContext.AddMaterial(CurrentMaterial);
+
+		if (PreviewCompilationScope.IsRestricted())
+		{
+			FHLSLMaterialPreviewCompilation::AddPendingMaterial(*CurrentMaterial);
+		}
+
+		// Propagate the function change to this material
+		CurrentMaterial->PreEditChange(nullptr);
+		CurrentMaterial->PostEditChange();
+		CurrentMaterial->MarkPackageDirty();
+
+		if (bRebuildGraphs && CurrentMaterial->MaterialGraph)
+		{
+			CurrentMaterial->MaterialGraph->RebuildGraph();
+		}
+
+		MaterialEditor->NotifyExternalMaterialChange();
+
+		UMaterialInterface* MaterialInterface = MaterialEditor->GetMaterialInterface();
+		if (MaterialInterface && MaterialInterface->IsA<UMaterial>())
+		{
+			// Enable the Apply button
+			static_cast<FMaterialEditor*>(MaterialEditor)->bMaterialDirty = true;
+
+			if (Library.bAutomaticallyApply)
+			{
+				const FMaterialEditorCommands& Commands = FMaterialEditorCommands::Get();
+				MaterialEditor->GetToolkitCommands()->ExecuteAction(Commands.Apply.ToSharedRef());
+
+				UMaterial* OriginalMaterial = static_cast<FMaterialEditor*>(MaterialEditor)->OriginalMaterial;
+				if (PreviewCompilationScope.IsRestricted() && OriginalMaterial)
+				{
+					FHLSLMaterialPreviewCompilation::AddPendingMaterial(*OriginalMaterial);
+				}
+			}
+		}
+	}
+}
+
+///////////////////////////////////////////////////////////////////////////////
+///////////////////////////////////////////////////////////////////////////////
+///////////////////////////////////////////////////////////////////////////////
+
+FHLSLMaterialFunctionGenerator::FExpressionPool::FExpressionPool(UMaterialFunction& MaterialFunction, const FString& GuidSeed)
+	: MaterialFunction(MaterialFunction)
+	, GuidSeed(GuidSeed)
+{
+	for (UMaterialExpression* Expression : MaterialFunction.FunctionExpressions)
+	{
+		if (Expression)
+		{
+			Expressions.FindOrAdd(Expression->GetClass()).Add(Expression);
+		}
+	}
+	for (UMaterialExpressionComment* Comment : MaterialFunction.FunctionEditorComments)
+	{
+		if (Comment)
+		{
+			Expressions.FindOrAdd(Comment->GetClass()).Add(Comment);
+		}
+	}
+
+	// Expressions are popped from the end, but should be handed out in their previous order
+	for (auto& It : Expressions)
+	{
+		Algo::Reverse(It.Value);
+	}
+}
+
+FGuid FHLSLMaterialFunctionGenerator::FExpressionPool::MakeGuid(const FString& Role) const
+{
+	return MakeGuid(GuidSeed, Role);
+}
+
+FGuid FHLSLMaterialFunctionGenerator::FExpressionPool::MakeGuid(const FString& Seed, const FString& Role)
+{
+	return FHLSLMaterialUtilities::HashStringToGuid(Seed + "." + Role);
+}
+
+UMaterialExpression* FHLSLMaterialFunctionGenerator::FExpressionPool::New(UClass* Class, const FString& Role)
+{
+	// Not using the global per-class name counter, so that fresh generations give the same asset on any machine
+	const FName Name = MakeName(Class, Role);
+
+	TArray<UMaterialExpression*>* ExistingExpressions = Expressions.Find(Class);
+	if (!ExistingExpressions || ExistingExpressions->Num() == 0)
+	{
+		NumCreated++;
+
+		FreeName(Name, nullptr);
+
+		UMaterialExpression* Expression = NewObject<UMaterialExpression>(&MaterialFunction, Class, Name);
+		Expression->MaterialExpressionGuid = MakeGuid(Role);
+		return Expression;
+	}
+
+	NumReused++;
+
+	// Prefer the expression previously generated for this role, so that it doesn't need to be renamed
+	int32 ExpressionIndex = ExistingExpressions->IndexOfByPredicate([&](const UMaterialExpression* Expression)
+	{
+		return Expression->GetFName() == Name;
+	});
+	if (ExpressionIndex == INDEX_NONE)
+	{
+		ExpressionIndex = ExistingExpressions->Num() - 1;
+	}
+
+	UMaterialExpression* Expression = (*ExistingExpressions)[ExpressionIndex];
+	ExistingExpressions->RemoveAt(ExpressionIndex, 1, false);
+
+	if (Expression->GetFName() != Name)
+	{
+		FreeName(Name, Expression);
+		Expression->Rename(*Name.ToString(), nullptr, REN_DontCreateRedirectors | REN_NonTransactional | REN_ForceNoResetLoaders);
+	}
+	Expression->MaterialExpressionGuid = MakeGuid(Role);
+
+	// Links are always recreated
+	for (int32 Index = 0; FExpressionInput* Input = Expression->GetInput(Index); Index++)
+	{
+		Input->Expression = nullptr;
+	}
+
+	return Expression;
+}
+
+FName FHLSLMaterialFunctionGenerator::FExpressionPool::MakeName(UClass* Class, const FString& Role)
+{
+	FString Name = Class->GetName() + "_" + Role;
+	for (TCHAR& Char : Name.GetCharArray())
+	{
+		if (Char != TEXT('\0') && !FChar::IsAlnum(Char))
+		{
+			Char = TEXT('_');
+		}
+	}
+	return *Name;
+}
+
+void FHLSLMaterialFunctionGenerator::FExpressionPool::FreeName(FName Name, const UObject* Owner) const
+{
+	UObject* ExistingObject = StaticFindObjectFast(nullptr, &MaterialFunction, Name);
+	if (ExistingObject && ExistingObject != Owner)
+	{
+		// Either unused, or a pooled expression that will be renamed when handed out
+		ExistingObject->Rename(nullptr, nullptr, REN_DontCreateRedirectors | REN_NonTransactional | REN_ForceNoResetLoaders);
+	}
+}
+
+///////////////////////////////////////////////////////////////////////////////
+///////////////////////////////////////////////////////////////////////////////
+///////////////////////////////////////////////////////////////////////////////
+
+TArray<FHLSLMaterialFunctionGenerator::FDependency> FHLSLMaterialFunctionGenerator::GetDependencies(const FString& Code)
+{
+	struct FUsage
+	{
+		// Prefix of a Parameters member or a helper function
+		const TCHAR* Prefix;
+		const TCHAR* Name;
+		UClass* Class;
+		int32 Index;
+	};
+
+	const FUsage Usages[] =
+	{
+		// Index is taken from the array access
+		{ TEXT("Parameters.TexCoords"), TEXT("TEXCOORD"), UMaterialExpressionTextureCoordinate::StaticClass(), 0 },
+		{ TEXT("Parameters.VertexColor"), TEXT("VERTEX_COLOR"), UMaterialExpressionVertexColor::StaticClass(), 0 },
+		{ TEXT("Parameters.LightmapUVs"), TEXT("LIGHTMAP_UVS"), UMaterialExpressionLightmapUVs::StaticClass(), 0 },
+		{ TEXT("Parameters.TangentToWorld"), TEXT("TANGENT_BASIS"), UMaterialExpressionVertexNormalWS::StaticClass(), 0 },
+		{ TEXT("Parameters.WorldNormal"), TEXT("TANGENT_BASIS"), UMaterialExpressionVertexNormalWS::StaticClass(), 0 },
+		{ TEXT("Parameters.WorldTangent"), TEXT("TANGENT_BASIS"), UMaterialExpressionVertexNormalWS::StaticClass(), 0 },
+		{ TEXT("Parameters.ReflectionVector"), TEXT("TANGENT_BASIS"), UMaterialExpressionVertexNormalWS::StaticClass(), 0 },
+		{ TEXT("Parameters.Particle.Color"), TEXT("PARTICLE_COLOR"), UMaterialExpressionParticleColor::StaticClass(), 0 },
+		{ TEXT("Parameters.Particle.PositionAndSize"), TEXT("PARTICLE_POSITION"), UMaterialExpressionParticlePositionWS::StaticClass(), 0 },
+		{ TEXT("Parameters.Particle.TranslatedWorldPositionAndSize"), TEXT("PARTICLE_POSITION"), UMaterialExpressionParticlePositionWS::StaticClass(), 0 },
+		{ TEXT("Parameters.Particle.Velocity"), TEXT("PARTICLE_VELOCITY"), UMaterialExpressionParticleDirection::StaticClass(), 0 },
+		{ TEXT("Parameters.Particle.RelativeTime"), TEXT("PARTICLE_TIME"), UMaterialExpressionParticleRelativeTime::StaticClass(), 0 },
+		{ TEXT("Parameters.Particle.Random"), TEXT("PARTICLE_RANDOM"), UMaterialExpressionParticleRandom::StaticClass(), 0 },
+		{ TEXT("Parameters.Particle.Size"), TEXT("PARTICLE_SIZE"), UMaterialExpressionParticleSize::StaticClass(), 0 },
+		{ TEXT("Parameters.Particle.MotionBlurFade"), TEXT("PARTICLE_MOTION_BLUR_FADE"), UMaterialExpressionParticleMotionBlurFade::StaticClass(), 0 },
+		{ TEXT("Parameters.Particle.MacroUV"), TEXT("PARTICLE_MACRO_UV"), UMaterialExpressionParticleMacroUV::StaticClass(), 0 },
+		// Longest first, as DynamicParameter is a prefix of the others
+		{ TEXT("Parameters.Particle.DynamicParameter3"), TEXT("DYNAMIC_PARAMETER_3"), UMaterialExpressionDynamicParameter::StaticClass(), 3 },
+		{ TEXT("Parameters.Particle.DynamicParameter2"), TEXT("DYNAMIC_PARAMETER_2"), UMaterialExpressionDynamicParameter::StaticClass(), 2 },
+		{ TEXT("Parameters.Particle.DynamicParameter1"), TEXT("DYNAMIC_PARAMETER_1"), UMaterialExpressionDynamicParameter::StaticClass(), 1 },
+		{ TEXT("Parameters.Particle.DynamicParameter"), TEXT("DYNAMIC_PARAMETER_0"), UMaterialExpressionDynamicParameter::StaticClass(), 0 },
+		{ TEXT("Parameters.PerInstanceRandom"), TEXT("PER_INSTANCE_RANDOM"), UMaterialExpressionPerInstanceRandom::StaticClass(), 0 },
+		{ TEXT("GetPerInstanceRandom"), TEXT("PER_INSTANCE_RANDOM"), UMaterialExpressionPerInstanceRandom::StaticClass(), 0 },
+		{ TEXT("Parameters.PerInstanceFadeAmount"), TEXT("PER_INSTANCE_FADE_AMOUNT"), UMaterialExpressionPerInstanceFadeAmount::StaticClass(), 0 },
+		{ TEXT("GetPerInstanceFadeAmount"), TEXT("PER_INSTANCE_FADE_AMOUNT"), UMaterialExpressionPerInstanceFadeAmount::StaticClass(), 0 },
+		{ TEXT("GetPerInstanceCustomData"), TEXT("PER_INSTANCE_CUSTOM_DATA"), UMaterialExpressionPerInstanceCustomData::StaticClass(), 0 },
+		// GetWorldPosition_NoMaterialOffsets, GetPrevWorldPosition_NoMaterialOffsets...
+		{ TEXT("_NoMaterialOffsets"), TEXT("WORLD_POSITION"), UMaterialExpressionWorldPosition::StaticClass(), 0 },
+	};
+
+	// Strip the comments so that commented out code doesn't add dependencies
+	const FString CanonicalCode = FHLSLMaterialParser::CanonicalizeCode(Code);
+
+	TMap<FString, FDependency> Dependencies;
+
+	int32 Index = 0;
+	while (Index < CanonicalCode.Len())
+	{
+		const auto IsPathChar = [&](int32 CharIndex)
+		{
+			const TCHAR Char = CanonicalCode[CharIndex];
+			return FChar::IsAlnum(Char) || Char == TEXT('_') || Char == TEXT('.');
+		};
+
+		if (!IsPathChar(Index))
+		{
+			Index++;
+			continue;
+		}
+
+		// Read a whole path, eg Parameters.Particle.Color
+		const int32 Start = Index;
+		while (Index < CanonicalCode.Len() && IsPathChar(Index))
+		{
+			Index++;
+		}
+
+		if (FChar::IsDigit(CanonicalCode[Start]) || CanonicalCode[Start] == TEXT('.'))
+		{
+			// Number
+			continue;
 		}
-	}
-
-	for (int32 Layer = 0; Layer < StaticBoolParameters.Num(); Layer++)
-	{
-		const int32 InputIndex = StaticBoolParameters[Layer];
-		const FPin& Input = Inputs[InputIndex];
 
-		const TArray<TArray<FOutputPin>> PreviousAllOutputPins = MoveTemp(AllOutputPins);
+		const FString Path = CanonicalCode.Mid(Start, Index - Start);
 
-		for (int32 Width = 0; Width < 1 << (StaticBoolParameters.Num() - Layer - 1); Width++)
+		for (const FUsage& Usage : Usages)
 		{
-			TArray<FOutputPin>& OutputPins = AllOutputPins.Emplace_GetRef();
-			for (int32 Index = 0; Index < Outputs.Num(); Index++)
+			const bool bMatches =
+				Usage.Prefix[0] == TEXT('_')
+				? Path.Contains(Usage.Prefix, ESearchCase::CaseSensitive)
+				: Path.StartsWith(Usage.Prefix, ESearchCase::CaseSensitive);
+
+			if (!bMatches)
+			{
+				continue;
+			}
+
+			int32 DependencyIndex = Usage.Index;
+			if (Usage.Class == UMaterialExpressionTextureCoordinate::StaticClass())
 			{
-				UClass* Class = UMaterialExpressionStaticSwitch::StaticClass();
-				if (Input.IsCurrentFramePin())
+				// Parameters.TexCoords[N]
+				if (Index >= CanonicalCode.Len() || CanonicalCode[Index] != TEXT('['))
 				{
-					Class = UMaterialExpressionPreviousFrameSwitch::StaticClass();
+					// Not a constant index, eg passing the whole array: request the max
+					DependencyIndex = 7;
 				}
-
-				UMaterialExpression* StaticSwitch = NewObject<UMaterialExpression>(MaterialFunction, Class);
-				StaticSwitch->MaterialExpressionGuid = FGuid::NewGuid();
-				StaticSwitch->MaterialExpressionEditorX = (Layer + 2) * 500;
-				StaticSwitch->MaterialExpressionEditorY = 200 * Width;
-				MaterialFunction->FunctionExpressions.Add(StaticSwitch);
-
-				const FOutputPin& OutputPinA = PreviousAllOutputPins[2 * Width + 0][Index];
-				const FOutputPin& OutputPinB = PreviousAllOutputPins[2 * Width + 1][Index];
-
-				StaticSwitch->GetInput(0)->Connect(OutputPinA.Index, OutputPinA.Expression);
-				StaticSwitch->GetInput(1)->Connect(OutputPinB.Index, OutputPinB.Expression);
-
-				if (!Input.IsCurrentFramePin())
+				else
 				{
-					StaticSwitch->GetInput(2)->Connect(0, FunctionInputs[InputIndex]);
+					int32 End = Index + 1;
+					while (End < CanonicalCode.Len() && FChar::IsDigit(CanonicalCode[End]))
+					{
+						End++;
+					}
+					DependencyIndex = End < CanonicalCode.Len() && CanonicalCode[End] == TEXT(']') && End > Index + 1
+						? FCString::Atoi(*CanonicalCode.Mid(Index + 1, End - Index - 1))
+						: 7;
 				}
+			}
 
-				OutputPins.Add({ StaticSwitch, 0 });
+			FDependency* Dependency = Dependencies.Find(Usage.Name);
+			if (!Dependency)
+			{
+				Dependency = &Dependencies.Add(Usage.Name);
+				Dependency->Name = Usage.Name;
+				Dependency->Class = Usage.Class;
+				Dependency->Index = DependencyIndex;
 			}
+			// A single texture coordinate node with the max index is enough to set NUM_TEX_COORD_INTERPOLATORS
+			Dependency->Index = FMath::Max(Dependency->Index, DependencyIndex);
+			break;
 		}
 	}
 
-	ensure(AllOutputPins.Num() == 1);
-	for (int32 Index = 0; Index < Outputs.Num(); Index++)
-	{
-		const FOutputPin& Pin = AllOutputPins[0][Index];
-		UMaterialExpressionFunctionOutput* FunctionOutput = FunctionOutputs[Index];
+	TArray<FDependency> Result;
+	Dependencies.GenerateValueArray(Result);
+	Result.Sort([](const FDependency& A, const FDependency& B) { return A.Name < B.Name; });
+	return Result;
+}
 
-		// Add multiply node to mitigate 5.0 bug where custom node output are incorrectly translated if linked directly to a material output
-		UMaterialExpressionMultiply* Multiply = NewObject<UMaterialExpressionMultiply>(MaterialFunction);
-		Multiply->MaterialExpressionGuid = FGuid::NewGuid();
-		Multiply->MaterialExpressionEditorX = FunctionOutput->MaterialExpressionEditorX - 50;
-		Multiply->MaterialExpressionEditorY = FunctionOutput->MaterialExpressionEditorY;
-		MaterialFunction->FunctionExpressions.Add(Multiply);
+///////////////////////////////////////////////////////////////////////////////
+///////////////////////////////////////////////////////////////////////////////
+///////////////////////////////////////////////////////////////////////////////
 
-		Multiply->GetInput(0)->Connect(Pin.Index, Pin.Expression);
-		FunctionOutput->GetInput(0)->Connect(0, Multiply);
+FString FHLSLMaterialFunctionGenerator::CheckBudget(const UHLSLMaterialFunctionLibrary& Library, const FHLSLMaterialFunction& Function, const TMap<FString, FString>& FunctionMetadata, const TCHAR* Key, int32 Value)
+{
+	const FString* Budget = FunctionMetadata.Find(Key);
+	if (!Budget || Value <= FCString::Atoi(**Budget))
+	{
+		return {};
 	}
 
+	const FString Message = FString::Printf(TEXT("%s budget exceeded: %d > %s"), Key, Value, **Budget);
+	if (Library.BudgetViolation == EHLSLMaterialBudgetViolation::Error)
 	{
-		UMaterialExpressionComment* Comment = NewObject<UMaterialExpressionComment>(MaterialFunction);
-		Comment->MaterialExpressionGuid = FGuid::NewGuid();
-		Comment->MaterialExpressionEditorX = 0;
-		Comment->MaterialExpressionEditorY = -200;
-		Comment->SizeX = 1000;
-		Comment->SizeY = 100;
-		Comment->Text = "DO NOT MODIFY THIS\nAutogenerated from " + Library.File.FilePath + "\nLibrary " + Library.GetPathName() + "\n" + Function.HashedString;
-		MaterialFunction->FunctionEditorComments.Add(Comment);
+		return Message;
 	}
 
-	// Update open material editors
-	for (TObjectIterator<UMaterial> It; It; ++It)
+	FHLSLMaterialMessages::ShowWarningAtLine(Function.DeclarationLine, TEXT("Function %s: %s"), *Function.Name, *Message);
+	return {};
+}
+
+FString FHLSLMaterialFunctionGenerator::GetCommentsText(const UMaterialFunction& MaterialFunction)
+{
+	FString Text;
+	for (const UMaterialExpressionComment* Comment : MaterialFunction.FunctionEditorComments)
 	{
-		UMaterial* CurrentMaterial = *It;
-		if (!CurrentMaterial->bIsPreviewMaterial)
+		if (Comment)
 		{
-			continue;
+			Text += Comment->Text + "\n";
 		}
+	}
+	return Text;
+}
 
-		IMaterialEditor* MaterialEditor = FindMaterialEditorForAsset(CurrentMaterial);
-		if (!MaterialEditor)
+FString FHLSLMaterialFunctionGenerator::GetGraphState(UMaterialFunction& MaterialFunction)
+{
+	// Object references are exported as paths, so this is stable across sessions
+	const auto ExportProperties = [](FString& State, UObject* Object)
+	{
+		for (TFieldIterator<FProperty> It(Object->GetClass()); It; ++It)
 		{
-			continue;
-		}
-
-		UpdateContext.AddMaterial(CurrentMaterial);
-
-		// Propagate the function change to this material
-		CurrentMaterial->PreEditChange(nullptr);
-		CurrentMaterial->PostEditChange();
-		CurrentMaterial->MarkPackageDirty();
+			if (It->HasAnyPropertyFlags(CPF_Transient))
+			{
+				continue;
+			}
 
-		if (CurrentMaterial->MaterialGraph)
-		{
-			CurrentMaterial->MaterialGraph->RebuildGraph();
+			for (int32 Index = 0; Index < It->ArrayDim; Index++)
+			{
+				State += It->GetName() + "=";
+				It->ExportText_InContainer(Index, State, Object, nullptr, Object, PPF_None);
+				State += "\n";
+			}
 		}
+	};
 
-		MaterialEditor->NotifyExternalMaterialChange();
+	FString State;
+	State += MaterialFunction.Description + "\n";
+	State += MaterialFunction.bExposeToLibrary ? "Exposed\n" : "Hidden\n";
+	for (const FText& Category : MaterialFunction.LibraryCategoriesText)
+	{
+		State += Category.ToString() + "\n";
+	}
 
-		UMaterialInterface* MaterialInterface = MaterialEditor->GetMaterialInterface();
-		if (MaterialInterface && MaterialInterface->IsA<UMaterial>())
+	// Editor comments are ignored, as they only hold the hash
+	for (UMaterialExpression* Expression : MaterialFunction.FunctionExpressions)
+	{
+		if (Expression)
 		{
-			// Enable the Apply button
-			static_cast<FMaterialEditor*>(MaterialEditor)->bMaterialDirty = true;
-
-			if (Library.bAutomaticallyApply)
-			{
-				const FMaterialEditorCommands& Commands = FMaterialEditorCommands::Get();
-				MaterialEditor->GetToolkitCommands()->ExecuteAction(Commands.Apply.ToSharedRef());
-			}
+			State += Expression->GetPathName() + "\n";
+			ExportProperties(State, Expression);
 		}
 	}
 
-	FNotificationInfo Info(FText::Format(INVTEXT("{0} updated"), FText::FromString(Function.Name)));
-	Info.ExpireDuration = 5.f;
-	Info.CheckBoxState = ECheckBoxState::Checked;
-	FSlateNotificationManager::Get().AddNotification(Info);
-
-	return {};
+	return State;
 }
 
-///////////////////////////////////////////////////////////////////////////////
-///////////////////////////////////////////////////////////////////////////////
-///////////////////////////////////////////////////////////////////////////////
-
 FString FHLSLMaterialFunctionGenerator::FPin::ParseTypeAndDefaultValue()
 {
 	const FString DefaultValueError = Name + ": invalid default value for type " + Type + ": " + DefaultValue;
@@ -849,51 +1783,17 @@ FString FHLSLMaterialFunctionGenerator::FPin::ParseTypeAndDefaultValue()
 			}
 		}
 	}
-	else if (Type == "int" || Type == "uint")
-	{
-		FunctionInputType = FunctionInput_Scalar;
-
-		if (!DefaultValue.IsEmpty() && !ParseDefaultValue(DefaultValue, 1, DefaultValueVector))
-		{
-			return DefaultValueError;
-		}
-	}
-	else if (Type == "float")
-	{
-		FunctionInputType = FunctionInput_Scalar;
-		CustomOutputType = CMOT_Float1;
-
-		if (!DefaultValue.IsEmpty() && !ParseDefaultValue(DefaultValue, 1, DefaultValueVector))
-		{
-			return DefaultValueError;
-		}
-	}
-	else if (Type == "float2")
-	{
-		FunctionInputType = FunctionInput_Vector2;
-		CustomOutputType = CMOT_Float2;
-
-		if (!DefaultValue.IsEmpty() && !ParseDefaultValue(DefaultValue, 2, DefaultValueVector))
-		{
-			return DefaultValueError;
-		}
-	}
-	else if (Type == "float3")
+	else if (const int32 Dimension = GetNumericVectorDimension(Type))
 	{
-		FunctionInputType = FunctionInput_Vector3;
-		CustomOutputType = CMOT_Float3;
+		static const EFunctionInputType InputTypes[] = { FunctionInput_Scalar, FunctionInput_Vector2, FunctionInput_Vector3, FunctionInput_Vector4 };
+		// Custom node outputs are MaterialFloats, which are already half precision on platforms that support it
+		// Integer outputs are converted to float
+		static const ECustomMaterialOutputType OutputTypes[] = { CMOT_Float1, CMOT_Float2, CMOT_Float3, CMOT_Float4 };
 
-		if (!DefaultValue.IsEmpty() && !ParseDefaultValue(DefaultValue, 3, DefaultValueVector))
-		{
-			return DefaultValueError;
-		}
-	}
-	else if (Type == "float4")
-	{
-		FunctionInputType = FunctionInput_Vector4;
-		CustomOutputType = CMOT_Float4;
+		FunctionInputType = InputTypes[Dimension - 1];
+		CustomOutputType = OutputTypes[Dimension - 1];
 
-		if (!DefaultValue.IsEmpty() && !ParseDefaultValue(DefaultValue, 4, DefaultValueVector))
+		if (!DefaultValue.IsEmpty() && !FHLSLMaterialParser::ParseDefaultValue(DefaultValue, Type, Dimension, DefaultValueVector))
 		{
 			return DefaultValueError;
 		}
@@ -956,187 +1856,306 @@ FString FHLSLMaterialFunctionGenerator::FPin::ParseTypeAndDefaultValue()
 	return {};
 }
 
-FString FHLSLMaterialFunctionGenerator::GenerateFunctionCode(const UHLSLMaterialFunctionLibrary& Library, const FHLSLMaterialFunction& Function, const TArray<FString>& Structs, const FString& Declarations)
+int32 FHLSLMaterialFunctionGenerator::GetVectorDimension(const FString& Type, const TCHAR* ScalarType)
 {
-	FString Code;
-	for (const FString& Struct : Structs)
+	if (!Type.StartsWith(ScalarType, ESearchCase::CaseSensitive))
 	{
-		Code += Struct;
+		return 0;
 	}
 
-	Code += Function.Body.Replace(TEXT("return"), TEXT("return 0.f"));
-
-	if (Library.bAccurateErrors)
+	const FString Suffix = Type.RightChop(FCString::Strlen(ScalarType));
+	if (Suffix.IsEmpty())
 	{
-		Code = FString::Printf(TEXT(
-			"#line %d \"%s%s%s\"\n%s\n#line 10000 \"Error occured outside of Custom HLSL node, line number will be inaccurate. "
-			"Untick bAccurateErrors on your HLSL library to fix this (%s)\""),
-			Function.StartLine + 1,
-			FHLSLMaterialErrorHook::PathPrefix,
-			*Library.File.FilePath,
-			FHLSLMaterialErrorHook::PathSuffix,
-			*Code,
-			*Library.GetPathName());
+		return 1;
 	}
-
-	return FString::Printf(TEXT("// START %s\n\n%s\n%s\n\n// END %s\n\nreturn 0.f;\n//%s\n"), *Function.Name, *Declarations, *Code, *Function.Name, *Function.HashedString);
+	if (Suffix.Len() == 1 && TEXT('2') <= Suffix[0] && Suffix[0] <= TEXT('4'))
+	{
+		return Suffix[0] - TEXT('0');
+	}
+	return 0;
 }
 
-bool FHLSLMaterialFunctionGenerator::ParseDefaultValue(const FString& DefaultValue, int32 Dimension, FVector4& OutValue)
+FString FHLSLMaterialFunctionGenerator::GetSharedSampler(const FString& SamplerName)
 {
-	const FString FloatPattern = R"_(\s*(-?\s*\+?\s*(?:[0-9]*[.])?[0-9]*)f?\s*)_";
+	if (SamplerName == TEXT("Wrap"))
+	{
+		// Wrap sampler using the world group texture settings, same as SSM_Wrap_WorldGroupSettings
+		return "Material.Wrap_WorldGroupSettings";
+	}
+	if (SamplerName == TEXT("Clamp"))
+	{
+		return "Material.Clamp_WorldGroupSettings";
+	}
+	if (SamplerName == TEXT("BilinearWrap"))
+	{
+		return "View.SharedBilinearWrappedSampler";
+	}
+	if (SamplerName == TEXT("BilinearClamp"))
+	{
+		return "View.SharedBilinearClampedSampler";
+	}
+	if (SamplerName == TEXT("PointWrap"))
+	{
+		return "View.SharedPointWrappedSampler";
+	}
+	if (SamplerName == TEXT("PointClamp"))
+	{
+		return "View.SharedPointClampedSampler";
+	}
+	return {};
+}
 
-	const auto TryParseFloat = [&](const FString& String, auto& OutFloatValue)
+int32 FHLSLMaterialFunctionGenerator::GetNumericVectorDimension(const FString& Type)
+{
+	for (const TCHAR* ScalarType : { TEXT("float"), TEXT("half"), TEXT("min16float"), TEXT("int"), TEXT("uint") })
 	{
-		FRegexPattern RegexPattern("^" + FloatPattern + "$");
-		FRegexMatcher RegexMatcher(RegexPattern, String);
-		if (!RegexMatcher.FindNext())
+		if (const int32 Dimension = GetVectorDimension(Type, ScalarType))
 		{
-			return false;
+			return Dimension;
 		}
+	}
+	return 0;
+}
 
-		OutFloatValue = FCString::Atof(*RegexMatcher.GetCaptureGroup(1));
-		return true;
-	};
-
-	if (Dimension == 1)
+bool FHLSLMaterialFunctionGenerator::GetMatrixDimensions(const FString& Type, int32& OutNumRows, int32& OutNumColumns)
+{
+	// floatRxC or halfRxC
+	if (!Type.StartsWith(TEXT("float"), ESearchCase::CaseSensitive) &&
+		!Type.StartsWith(TEXT("half"), ESearchCase::CaseSensitive))
 	{
-		return TryParseFloat(DefaultValue, OutValue.X);
+		return false;
 	}
-	else if (Dimension == 2)
+
+	const FString Suffix = Type.Right(3);
+	if (Type.Len() - 3 != (Type.StartsWith(TEXT("float")) ? 5 : 4) ||
+		Suffix[1] != TEXT('x') ||
+		!(TEXT('2') <= Suffix[0] && Suffix[0] <= TEXT('4')) ||
+		!(TEXT('2') <= Suffix[2] && Suffix[2] <= TEXT('4')))
 	{
-		float SingleValue;
-		if (TryParseFloat(DefaultValue, SingleValue))
-		{
-			OutValue = FVector4(SingleValue);
-			return true;
-		}
+		return false;
+	}
 
-		FRegexPattern RegexPattern("^float2\\("+ FloatPattern + "," + FloatPattern + "\\)$");
-		FRegexMatcher RegexMatcher(RegexPattern, DefaultValue);
-		if (!RegexMatcher.FindNext())
-		{
-			return false;
-		}
+	OutNumRows = Suffix[0] - TEXT('0');
+	OutNumColumns = Suffix[2] - TEXT('0');
+	return true;
+}
+
+TArray<FString> FHLSLMaterialFunctionGenerator::ParseValues(const FString& Values)
+{
+	TArray<FString> Result;
+	Values.ParseIntoArray(Result, TEXT(","), false);
 
-		OutValue.X = FCString::Atof(*RegexMatcher.GetCaptureGroup(1));
-		OutValue.Y = FCString::Atof(*RegexMatcher.GetCaptureGroup(2));
+	for (FString& Value : Result)
+	{
+		Value.TrimStartAndEndInline();
+	}
 
-		return true;
+	return Result;
+}
+
+FString FHLSLMaterialFunctionGenerator::GetValueConstants(const FString& Name, const TArray<FString>& Values)
+{
+	FString Result;
+	for (int32 Index = 0; Index < Values.Num(); Index++)
+	{
+		Result += FString::Printf(TEXT("const int %s_%s = %d;\n"), *Name, *Values[Index], Index);
 	}
-	else if (Dimension == 3)
+	return Result;
+}
+
+void FHLSLMaterialFunctionGenerator::StripDebugOnlyFunctions(TArray<FHLSLMaterialFunction>& Functions)
+{
+	for (FHLSLMaterialFunction& Function : Functions)
 	{
-		float SingleValue;
-		if (TryParseFloat(DefaultValue, SingleValue))
+		FHLSLMaterialSignature Signature;
+		if (!FHLSLMaterialParser::ParseSignature(Function, Signature).IsEmpty() ||
+			!Signature.Metadata.Contains(FUNC_META_DebugOnly))
 		{
-			OutValue = FVector4(SingleValue);
-			return true;
+			// Signature errors are reported when generating the function
+			continue;
 		}
 
-		FRegexPattern RegexPattern("^float3\\("+ FloatPattern + "," + FloatPattern + "," + FloatPattern + "\\)$");
-		FRegexMatcher RegexMatcher(RegexPattern, DefaultValue);
-		if (!RegexMatcher.FindNext())
+		FString Body = "\n";
+		for (const FHLSLMaterialArgument& Argument : Signature.Arguments)
 		{
-			return false;
+			if (Argument.bIsOutput)
+			{
+				Body += "\t" + Argument.Name + " = (" + Argument.Type + ")0;\n";
+			}
+		}
+		if (Function.ReturnType != "void")
+		{
+			Body += "\treturn (" + Function.ReturnType + ")0;\n";
 		}
+		Function.Body = Body;
+	}
+}
+
+FString FHLSLMaterialFunctionGenerator::GenerateShaderFile(
+	const UHLSLMaterialFunctionLibrary& Library,
+	const TArray<FString>& IncludeFilePaths,
+	const TArray<FCustomDefine>& AdditionalDefines,
+	const TArray<FString>& Structs,
+	const TArray<FHLSLMaterialFunction>& Functions,
+	FString& OutText,
+	TArray<FHLSLMaterialFunction>& OutExportedFunctions)
+{
+	OutText = FString::Printf(TEXT("// Generated from %s, do not edit\n\n#pragma once\n\n"), *Library.GetPathName());
 
-		OutValue.X = FCString::Atof(*RegexMatcher.GetCaptureGroup(1));
-		OutValue.Y = FCString::Atof(*RegexMatcher.GetCaptureGroup(2));
-		OutValue.Z = FCString::Atof(*RegexMatcher.GetCaptureGroup(3));
+	for (const FString& IncludeFilePath : IncludeFilePaths)
+	{
+		OutText += "#include \"" + IncludeFilePath + "\"\n";
+	}
+	for (const FCustomDefine& Define : AdditionalDefines)
+	{
+		OutText += "#define " + Define.DefineName + " " + Define.DefineValue + "\n";
+	}
+	OutText += "\n";
 
-		return true;
+	for (const FString& Struct : Structs)
+	{
+		OutText += Struct + "\n\n";
 	}
-	else
+
+	// Lines of OutText counted so far, to point #line back to the generated file after each function
+	int32 NumLines = 0;
+	int32 CountedLength = 0;
+
+	for (const FHLSLMaterialFunction& Function : Functions)
 	{
-		check(Dimension == 4);
+		// eg const int Mode_A = 0; for [Values(A, B)] int Mode
+		FString ValueConstants;
 
-		float SingleValue;
-		if (TryParseFloat(DefaultValue, SingleValue))
-		{
-			OutValue = FVector4(SingleValue);
-			return true;
-		}
+		// Helpers are written as is, and only exist in the shader file
+		FString Declaration = Function.ReturnType + " " + Function.Name + "(" + FString::Join(Function.Arguments, TEXT(",")) + ")";
 
-		FRegexPattern RegexPattern("^float4\\("+ FloatPattern + "," + FloatPattern + "," + FloatPattern + "," + FloatPattern + "\\)$");
-		FRegexMatcher RegexMatcher(RegexPattern, DefaultValue);
-		if (!RegexMatcher.FindNext())
+		if (Function.ReturnType == "void")
 		{
-			return false;
-		}
+			FHLSLMaterialSignature Signature;
+			const FString Error = FHLSLMaterialParser::ParseSignature(Function, Signature);
+			if (!Error.IsEmpty())
+			{
+				return "Function " + Function.Name + ": " + Error;
+			}
 
-		OutValue.X = FCString::Atof(*RegexMatcher.GetCaptureGroup(1));
-		OutValue.Y = FCString::Atof(*RegexMatcher.GetCaptureGroup(2));
-		OutValue.Z = FCString::Atof(*RegexMatcher.GetCaptureGroup(3));
-		OutValue.W = FCString::Atof(*RegexMatcher.GetCaptureGroup(4));
+			if (!Signature.Metadata.Contains(FUNC_META_Helper))
+			{
+				OutExportedFunctions.Add(Function);
 
-		return true;
-	}
-}
+				// Strip metadata & default values, these are handled by the material function
+				TArray<FString> Arguments;
+				for (const FHLSLMaterialArgument& Argument : Signature.Arguments)
+				{
+					if (const FString* Values = Argument.Metadata.Find(META_Values))
+					{
+						ValueConstants += GetValueConstants(Argument.Name, ParseValues(*Values));
+					}
 
-FString FHLSLMaterialFunctionGenerator::GenerateTooltip(const FString& ParamName, const FString& FunctionComment)
-{
-	FString Tooltip;
+					FString Type = Argument.Type;
+					if (!Argument.TemplateArgument.IsEmpty())
+					{
+						Type += "<" + Argument.TemplateArgument + ">";
+					}
 
-	int32 Index = 0;
-	while (Index < FunctionComment.Len())
-	{
-		Index = FunctionComment.Find(TEXT("@param"), ESearchCase::IgnoreCase, ESearchDir::FromStart, Index);
-		if (Index == -1)
-		{
-			break;
-		}
+					Arguments.Add(FString(Argument.bIsConst ? "const " : "") + (Argument.bIsOutput ? "out " : "") + Type + " " + Argument.Name);
+				}
 
-		Index += FString(TEXT("@param")).Len();
+				Declaration = "void " + Function.Name + "(" + FString::Join(Arguments, TEXT(", ")) + ")";
+			}
+		}
 
-		while (Index < FunctionComment.Len() && FChar::IsWhitespace(FunctionComment[Index]))
+		FString Line;
+		if (Library.bAccurateErrors && !Library.bCanonicalCode)
 		{
-			Index++;
+			Line = FString::Printf(TEXT("\n#line %d \"%s%s%s\"\n"),
+				Function.StartLine + 1,
+				FHLSLMaterialErrorHook::PathPrefix,
+				*Library.File.FilePath,
+				FHLSLMaterialErrorHook::PathSuffix);
 		}
 
-		FString CurrentParamName;
-		while (Index < FunctionComment.Len() && !FChar::IsWhitespace(FunctionComment[Index]))
+		if (!ValueConstants.IsEmpty())
 		{
-			CurrentParamName += FunctionComment[Index++];
+			ValueConstants = "\n" + ValueConstants.TrimEnd();
 		}
 
-		if (CurrentParamName != ParamName)
+		OutText += Declaration + "\n{" + ValueConstants + Line + Function.Body + "}\n";
+
+		if (!Line.IsEmpty())
 		{
-			continue;
+			for (; CountedLength < OutText.Len(); CountedLength++)
+			{
+				if (OutText[CountedLength] == TEXT('\n'))
+				{
+					NumLines++;
+				}
+			}
+
+			// Otherwise errors in the following functions would be attributed to this one
+			// + 2 as lines are 1-based, and the directive applies to the line after it
+			OutText += FString::Printf(TEXT("#line %d \"%s\"\n"), NumLines + 2, *Library.GetGeneratedShaderPath());
 		}
 
-		while (Index < FunctionComment.Len() && FChar::IsWhitespace(FunctionComment[Index]))
+		OutText += "\n";
+	}
+
+	if (Library.bCanonicalCode)
+	{
+		OutText = FHLSLMaterialParser::CanonicalizeCode(OutText);
+	}
+
+	return {};
+}
+
+FString FHLSLMaterialFunctionGenerator::GenerateFunctionCode(const UHLSLMaterialFunctionLibrary& Library, const FHLSLMaterialFunction& Function, const FHLSLMaterialSignature& Signature, const TArray<FString>& Structs, const FString& Declarations)
+{
+	if (Library.bGenerateShaderFile)
+	{
+		// The function is defined in the generated shader file, all that's left is to call it
+		TArray<FString> Arguments;
+		for (const FHLSLMaterialArgument& Argument : Signature.Arguments)
 		{
-			Index++;
+			Arguments.Add(Argument.Name);
 		}
 
-		while (Index < FunctionComment.Len() && !FChar::IsLinebreak(FunctionComment[Index]))
+		const FString Call = Function.Name + "(" + FString::Join(Arguments, TEXT(", ")) + ");";
+
+		if (Library.bCanonicalCode)
 		{
-			Tooltip += FunctionComment[Index++];
+			return FHLSLMaterialParser::CanonicalizeCode(Declarations + "\n" + Call) + "\nreturn 0.f;\n";
 		}
-		Tooltip.TrimStartAndEndInline();
 
-		break;
+		return FString::Printf(TEXT("// START %s\n\n%s\n%s\n\n// END %s\n\nreturn 0.f;\n//%s\n"), *Function.Name, *Declarations, *Call, *Function.Name, *Function.HashedString);
 	}
 
-	return Tooltip;
-}
+	FString Code;
+	for (const FString& Struct : Structs)
+	{
+		Code += Struct;
+	}
 
-TMap<FString, FString> FHLSLMaterialFunctionGenerator::GenerateMetadata(const FString& Metadata)
-{
-	TMap<FString, FString> Result;
+	Code += Function.Body.Replace(TEXT("return"), TEXT("return 0.f"));
 
-	FRegexPattern RegexPattern(R"_((\w+)\s*(?:=\s*((?:"[^"]*")|\w+))?\s*(?:,|$))_");
-	FRegexMatcher RegexMatcher(RegexPattern, Metadata);
-	while (RegexMatcher.FindNext())
+	if (Library.bCanonicalCode)
 	{
-		const FString Key = RegexMatcher.GetCaptureGroup(1);
-		FString Value = RegexMatcher.GetCaptureGroup(2);
-		Value.RemoveFromStart(TEXT("\""));
-		Value.RemoveFromEnd(TEXT("\""));
-		Result.Add(Key, Value);
+		// No function name, library path, line numbers or hash: these would defeat the shader DDC
+		return FHLSLMaterialParser::CanonicalizeCode(Declarations + "\n" + Code) + "\nreturn 0.f;\n";
 	}
 
-	return Result;
+	if (Library.bAccurateErrors)
+	{
+		Code = FString::Printf(TEXT(
+			"#line %d \"%s%s%s\"\n%s\n#line 10000 \"Error occured outside of Custom HLSL node, line number will be inaccurate. "
+			"Untick bAccurateErrors on your HLSL library to fix this (%s)\""),
+			Function.StartLine + 1,
+			FHLSLMaterialErrorHook::PathPrefix,
+			*Library.File.FilePath,
+			FHLSLMaterialErrorHook::PathSuffix,
+			*Code,
+			*Library.GetPathName());
+	}
+
+	return FString::Printf(TEXT("// START %s\n\n%s\n%s\n\n// END %s\n\nreturn 0.f;\n//%s\n"), *Function.Name, *Declarations, *Code, *Function.Name, *Function.HashedString);
 }
 
 IMaterialEditor* FHLSLMaterialFunctionGenerator::FindMaterialEditorForAsset(UObject* InAsset)
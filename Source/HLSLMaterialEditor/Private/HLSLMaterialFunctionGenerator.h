@@ -4,12 +4,15 @@
 
 #include "CoreMinimal.h"
 #include "MaterialShared.h"
+#include "UObject/ObjectKey.h"
 #include "Materials/MaterialExpressionCustom.h"
 #include "Materials/MaterialExpressionFunctionInput.h"
+#include "HLSLMaterialFunction.h"
+#include "HLSLMaterialCostAnalyzer.h"
 
 class IMaterialEditor;
+class UMaterialFunction;
 class UHLSLMaterialFunctionLibrary;
-struct FHLSLMaterialFunction;
 
 class FHLSLMaterialFunctionGenerator
 {
@@ -20,9 +23,27 @@ public:
 		const TArray<FCustomDefine>& AdditionalDefines,
 		const TArray<FString>& Structs,
 		FHLSLMaterialFunction Function,
-		FMaterialUpdateContext& UpdateContext);
+		bool& bOutUpdated,
+		bool& bOutCodeOnly);
+
+	// Propagate the function changes to the opened material editors. Called once all the functions are generated
+	// If only the code of the Custom nodes changed, the material graphs don't need to be rebuilt
+	static void RefreshMaterialEditors(const UHLSLMaterialFunctionLibrary& Library, FMaterialUpdateContext& UpdateContext, bool bRebuildGraphs);
+
+	// Replace the body of [DebugOnly] functions by one zeroing their outputs, for build profiles with bStripDebugOnly
+	static void StripDebugOnlyFunctions(TArray<FHLSLMaterialFunction>& Functions);
+
+	// Write all the functions, structs & defines to a single shader file included by the Custom nodes
+	// Helpers, ie non-void or [Helper] functions, are only written to the file and aren't exported
+	static FString GenerateShaderFile(
+		const UHLSLMaterialFunctionLibrary& Library,
+		const TArray<FString>& IncludeFilePaths,
+		const TArray<FCustomDefine>& AdditionalDefines,
+		const TArray<FString>& Structs,
+		const TArray<FHLSLMaterialFunction>& Functions,
+		FString& OutText,
+		TArray<FHLSLMaterialFunction>& OutExportedFunctions);
 
-private:
 	struct FPin
 	{
 		const FString Name;
@@ -60,22 +81,206 @@ private:
 		bool bDefaultValueBool = false;
 		FVector4 DefaultValueVector{ ForceInit };
 
+		// Shared sampler to use instead of the texture one, eg Material.Wrap_WorldGroupSettings
+		FString SharedSampler;
+
+		// Function input name, if different from Name, eg Mode = B for the static bools of [Values] pins
+		FString DisplayName;
+
 		FString ParseTypeAndDefaultValue();
 
+		bool IsTexture() const
+		{
+			return
+				FunctionInputType == FunctionInput_Texture2D ||
+				FunctionInputType == FunctionInput_TextureCube ||
+				FunctionInputType == FunctionInput_Texture2DArray ||
+				FunctionInputType == FunctionInput_VolumeTexture ||
+				FunctionInputType == FunctionInput_TextureExternal;
+		}
+
 		bool IsCurrentFramePin() const
 		{
 			return Name == "bIsCurrentFrame";
 		}
+
+		// Output computed in the vertex shader & interpolated, see [Interpolate]
+		bool IsInterpolated() const
+		{
+			return bIsOutput && Metadata.Contains(META_Interpolate);
+		}
 	};
 
+	// Expression connected to the Custom nodes so that the material compiler enables a feature used by the code,
+	// eg a TextureCoordinate to ensure NUM_TEX_COORD_INTERPOLATORS is correct
+	struct FDependency
+	{
+		FString Name;
+		UClass* Class = nullptr;
+		// Texture coordinate or dynamic parameter index
+		int32 Index = 0;
+	};
+
+	// Static pins selecting between the Custom node permutations
+	// Bools use a single static bool, [Values] pins one static bool per value but the first
+	struct FSelector
+	{
+		TArray<int32> InputIndices;
+
+		// [Values] pins only
+		FString Name;
+		FString Type;
+		bool bIsConst = false;
+		TArray<FString> Values;
+
+		int32 GetNumValues() const
+		{
+			return InputIndices.Num() + 1;
+		}
+	};
+
+	// Everything known about a function before generating its graph
+	struct FAnalysis
+	{
+		FHLSLMaterialSignature Signature;
+		TArray<FPin> Inputs;
+		TArray<FPin> Outputs;
+		FString VariableDeclarations;
+		// Bools first, then [Values] pins
+		TArray<FSelector> Selectors;
+		int32 NumPermutations = 1;
+		int32 NumTextures = 0;
+		// Textures sharing a sampler count once
+		int32 NumSamplers = 0;
+		TArray<FDependency> Dependencies;
+	};
+	// Validates the function & computes its pins without touching any asset, eg for manifests
+	// Warnings are shown through FHLSLMaterialMessages
+	static FString AnalyzeFunction(const UHLSLMaterialFunctionLibrary& Library, const FHLSLMaterialFunction& Function, FAnalysis& OutAnalysis);
+	// One per value combination of the static pins, matching the generated Custom nodes
+	// The previous frame switch isn't a function input and is left out
+	static TArray<FHLSLMaterialCostAnalyzer::FPermutation> GetCostPermutations(const FAnalysis& Analysis);
+
+private:
+	// Hands out the expressions of the previous generation before creating new ones
+	class FExpressionPool
+	{
+	public:
+		// GUIDs are derived from GuidSeed & the expression role, so that identical graphs give identical assets
+		FExpressionPool(UMaterialFunction& MaterialFunction, const FString& GuidSeed);
+
+		FGuid MakeGuid(const FString& Role) const;
+		static FGuid MakeGuid(const FString& Seed, const FString& Role);
+
+		// Reused expressions are disconnected, but otherwise keep their previous state
+		// Object names are derived from the role too, as they end up in the asset & the graph state
+		UMaterialExpression* New(UClass* Class, const FString& Role);
+
+		template<typename T>
+		T* New(const FString& Role)
+		{
+			return CastChecked<T>(New(T::StaticClass(), Role));
+		}
+
+		int32 GetNumReused() const
+		{
+			return NumReused;
+		}
+		int32 GetNumCreated() const
+		{
+			return NumCreated;
+		}
+
+	private:
+		UMaterialFunction& MaterialFunction;
+		const FString GuidSeed;
+
+		// eg MaterialExpressionCustom_Custom_0
+		static FName MakeName(UClass* Class, const FString& Role);
+		// Renames any other object of the function using Name out of the way
+		void FreeName(FName Name, const UObject* Owner) const;
+
+		TMap<UClass*, TArray<UMaterialExpression*>> Expressions;
+		int32 NumReused = 0;
+		int32 NumCreated = 0;
+	};
+
+	// Parameters members & helper functions used by the code, sorted by name
+	static TArray<FDependency> GetDependencies(const FString& Code);
+
+	// Returns an error if the budget is exceeded & budget violations are errors
+	static FString CheckBudget(const UHLSLMaterialFunctionLibrary& Library, const FHLSLMaterialFunction& Function, const TMap<FString, FString>& FunctionMetadata, const TCHAR* Key, int32 Value);
+
+	// Everything that ends up in the asset, except the editor comments
+	static FString GetGraphState(UMaterialFunction& MaterialFunction);
+	// Text of the editor comments, ie the hashes
+	static FString GetCommentsText(const UMaterialFunction& MaterialFunction);
+
+	// Fast path when only the body, includes or defines changed: patches the existing Custom nodes in place
+	// Returns false if the graph needs to be rebuilt, ie the signature hash doesn't match or nodes are missing
+	static bool TryUpdateCode(
+		const UHLSLMaterialFunctionLibrary& Library,
+		const TArray<FString>& IncludeFilePaths,
+		const TArray<FCustomDefine>& AdditionalDefines,
+		const TArray<FString>& Structs,
+		const FHLSLMaterialFunction& Function,
+		const FAnalysis& Analysis,
+		const FString& SignatureHash,
+		UMaterialFunction& MaterialFunction,
+		bool& bOutUpdated);
+
+	// Compiling the permutations is slow: costs are only measured again once the generated graph or the code it includes changed
+	struct FMeasuredCost
+	{
+		FGuid StateId;
+		FString HashedString;
+		int32 NumInstructions = 0;
+		int32 NumSamplers = 0;
+	};
+	static TMap<FObjectKey, FMeasuredCost> MeasuredCosts;
+
+	static FString MeasureBudgets(const UHLSLMaterialFunctionLibrary& Library, const FHLSLMaterialFunction& Function, const FAnalysis& Analysis, UMaterialFunction& MaterialFunction);
+
+	// Hash of everything the graph depends on but the code, stored in the generated comment
+	static FString GetSignatureHash(const UHLSLMaterialFunctionLibrary& Library, const FHLSLMaterialFunction& Function, const FAnalysis& Analysis);
+	static FString GetCommentText(const UHLSLMaterialFunctionLibrary& Library, const FHLSLMaterialFunction& Function, const FString& SignatureHash);
+	static FString GetGuidSeed(const UHLSLMaterialFunctionLibrary& Library, const FHLSLMaterialFunction& Function);
+	// Variables declared at the start of the code of a given permutation, eg static bool values
+	static FString GetPermutationDeclarations(const FAnalysis& Analysis, int32 Permutation);
+	// Name of the function input generated for a non-exposed pin, eg Mode = B ( = false)
+	static FString GetFunctionInputName(const FPin& Input);
+
 	static constexpr const TCHAR* META_Expose = TEXT("Expose");
 	static constexpr const TCHAR* META_Category = TEXT("Category");
+	static constexpr const TCHAR* META_Sampler = TEXT("Sampler");
+	static constexpr const TCHAR* META_Interpolate = TEXT("Interpolate");
+	static constexpr const TCHAR* META_Static = TEXT("Static");
+	static constexpr const TCHAR* META_Dynamic = TEXT("Dynamic");
+	static constexpr const TCHAR* META_Values = TEXT("Values");
 	static constexpr const TCHAR* FUNC_META_Prefix = TEXT("Prefix");
+	static constexpr const TCHAR* FUNC_META_Helper = TEXT("Helper");
+	static constexpr const TCHAR* FUNC_META_MaxInstructions = TEXT("MaxInstructions");
+	static constexpr const TCHAR* FUNC_META_MaxSamplers = TEXT("MaxSamplers");
+	static constexpr const TCHAR* FUNC_META_MaxPermutations = TEXT("MaxPermutations");
+	static constexpr const TCHAR* FUNC_META_DebugOnly = TEXT("DebugOnly");
+
+	// Max number of samplers per shader stage on D3D11 & most mobile platforms
+	static constexpr int32 MaxSamplers = 16;
+
+	// eg Material.Wrap_WorldGroupSettings for Wrap, empty if invalid
+	static FString GetSharedSampler(const FString& SamplerName);
+	// eg 3 for float3, 0 if Type is not a ScalarType vector
+	static int32 GetVectorDimension(const FString& Type, const TCHAR* ScalarType);
+	// float, half, min16float, int & uint vectors
+	static int32 GetNumericVectorDimension(const FString& Type);
+	// eg 4 rows & 3 columns for float4x3
+	static bool GetMatrixDimensions(const FString& Type, int32& OutNumRows, int32& OutNumColumns);
+	// eg A, B & C for [Values(A, B, C)]
+	static TArray<FString> ParseValues(const FString& Values);
+	// eg const int Mode_A = 0; const int Mode_B = 1;
+	static FString GetValueConstants(const FString& Name, const TArray<FString>& Values);
 
-	static FString GenerateFunctionCode(const UHLSLMaterialFunctionLibrary& Library, const FHLSLMaterialFunction& Function, const TArray<FString>& Structs, const FString& Declarations);
-	static bool ParseDefaultValue(const FString& DefaultValue, int32 Dimension, FVector4& OutValue);
-	static FString GenerateTooltip(const FString& ParamName, const FString& FunctionComment);
-	static TMap<FString, FString> GenerateMetadata(const FString& Metadata);
+	static FString GenerateFunctionCode(const UHLSLMaterialFunctionLibrary& Library, const FHLSLMaterialFunction& Function, const FHLSLMaterialSignature& Signature, const TArray<FString>& Structs, const FString& Declarations);
 		
 	static IMaterialEditor* FindMaterialEditorForAsset(UObject* InAsset);
 	static UObject* CreateAsset(FString AssetName, FString FolderPath, UClass* Class, FString& OutError);
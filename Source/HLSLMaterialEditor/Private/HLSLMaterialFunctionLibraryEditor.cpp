@@ -4,12 +4,17 @@
 #include "HLSLMaterialFunction.h"
 #include "HLSLMaterialFunctionLibrary.h"
 #include "HLSLMaterialFunctionGenerator.h"
+#include "HLSLMaterialGenerationJob.h"
+#include "HLSLMaterialSourceFile.h"
 #include "HLSLMaterialParser.h"
 #include "HLSLMaterialUtilities.h"
 #include "HLSLMaterialFileWatcher.h"
 #include "HLSLMaterialMessages.h"
+#include "HLSLMaterialTimings.h"
 
+#include "Misc/ScopeExit.h"
 #include "Misc/FileHelper.h"
+#include "Misc/CoreDelegates.h"
 #include "AssetRegistry/AssetData.h"
 #include "Materials/MaterialFunction.h"
 #include "AssetRegistry/AssetRegistryModule.h"
@@ -54,9 +59,73 @@ void FHLSLMaterialFunctionLibraryEditor::Register()
 			ensure(AssetData.GetAsset());
 		}
 	});
+
+	if (IsRunningCookCommandlet() &&
+		UHLSLMaterialFunctionLibrary::GetActiveBuildProfile() != EHLSLMaterialBuildProfile::Editor)
+	{
+		RegenerateForCook();
+	}
 }
 HLSL_STARTUP_FUNCTION(EDelayedRegisterRunPhase::EndOfEngineInit, FHLSLMaterialFunctionLibraryEditor::Register);
 
+void FHLSLMaterialFunctionLibraryEditor::RegenerateForCook()
+{
+	IAssetRegistry& AssetRegistry = FModuleManager::LoadModuleChecked<FAssetRegistryModule>(TEXT("AssetRegistry")).Get();
+	AssetRegistry.SearchAllAssets(true);
+
+	TArray<FAssetData> AssetDatas;
+	AssetRegistry.GetAssetsByClass(UE_501_SWITCH(UHLSLMaterialFunctionLibrary::StaticClass()->GetFName(), UHLSLMaterialFunctionLibrary::StaticClass()->GetClassPathName()), AssetDatas);
+
+	// The generated functions are only modified in memory: if the cooker garbage collected them,
+	// they would be reloaded from disk with the code of the Editor profile
+	static TArray<UObject*> RootedObjects;
+	FCoreDelegates::OnPreExit.AddLambda([]
+	{
+		for (UObject* Object : RootedObjects)
+		{
+			Object->RemoveFromRoot();
+		}
+		RootedObjects.Reset();
+	});
+
+	const auto AddToRoot = [](UObject* Object)
+	{
+		if (Object && !Object->IsRooted())
+		{
+			Object->AddToRoot();
+			RootedObjects.Add(Object);
+		}
+	};
+
+	TArray<FString> FailedLibraries;
+	for (const FAssetData& AssetData : AssetDatas)
+	{
+		if (UHLSLMaterialFunctionLibrary* Library = Cast<UHLSLMaterialFunctionLibrary>(AssetData.GetAsset()))
+		{
+			AddToRoot(Library);
+
+			// The cooker doesn't save the generated functions back
+			if (!Generate(*Library, true))
+			{
+				FailedLibraries.Add(Library->GetPathName());
+			}
+
+			for (const TSoftObjectPtr<UMaterialFunction>& MaterialFunction : Library->MaterialFunctions)
+			{
+				AddToRoot(MaterialFunction.Get());
+			}
+		}
+	}
+
+	if (FailedLibraries.Num() > 0)
+	{
+		// The errors are already logged
+		UE_LOG(LogHLSLMaterial, Fatal, TEXT("Failed to regenerate %d HLSL libraries for the cook: %s"), FailedLibraries.Num(), *FString::Join(FailedLibraries, TEXT(", ")));
+	}
+
+	UE_LOG(LogHLSLMaterial, Log, TEXT("Regenerated %d HLSL libraries for the cook, keeping %d objects alive"), AssetDatas.Num(), RootedObjects.Num());
+}
+
 TSharedRef<FVirtualDestructor> FHLSLMaterialFunctionLibraryEditor::CreateWatcher(UHLSLMaterialFunctionLibrary& Library)
 {
 	FHLSLMaterialMessages::FLibraryScope Scope(Library);
@@ -90,42 +159,152 @@ TSharedRef<FVirtualDestructor> FHLSLMaterialFunctionLibraryEditor::CreateWatcher
 	return Watcher;
 }
 
-void FHLSLMaterialFunctionLibraryEditor::Generate(UHLSLMaterialFunctionLibrary& Library)
+bool FHLSLMaterialFunctionLibraryEditor::Generate(UHLSLMaterialFunctionLibrary& Library, bool bSynchronous)
 {
 	FHLSLMaterialMessages::FLibraryScope Scope(Library);
 
+	ON_SCOPE_EXIT
+	{
+		FHLSLMaterialTimings::Flush();
+	};
+
 	// Always recreate watcher in case includes changed
 	Library.CreateWatcherIfNeeded();
 
 	const FString FullPath = Library.GetFilePath();
 	
 	FString Text;
-	if (!TryLoadFileToString(Text, FullPath))
 	{
-		FHLSLMaterialMessages::ShowError(TEXT("Failed to read %s"), *FullPath);
-		return;
+		HLSL_TIMING_SCOPE(LoadFile, Library);
+
+		if (!TryLoadFileToString(Text, FullPath))
+		{
+			FHLSLMaterialMessages::ShowError(TEXT("Failed to read %s"), *FullPath);
+			return false;
+		}
 	}
-	
+
+	FPreparedLibrary PreparedLibrary;
+	if (!Prepare(Library, Text, PreparedLibrary))
+	{
+		return false;
+	}
+
+	if (Library.bGenerateShaderFile)
+	{
+		const FString& ShaderPath = PreparedLibrary.ShaderPath;
+
+		FString ShaderFilePath;
+		if (!UHLSLMaterialFunctionLibrary::RegisterGeneratedShaderDirectory(true) ||
+			!UHLSLMaterialFunctionLibrary::TryConvertShaderPathToFilename(ShaderPath, ShaderFilePath))
+		{
+			FHLSLMaterialMessages::ShowError(TEXT("Failed to map %s"), *ShaderPath);
+			return false;
+		}
+
+		// Don't touch the file if it's up to date, to not trigger any shader recompilation
+		FString ExistingShaderText;
+		if (!FFileHelper::LoadFileToString(ExistingShaderText, *ShaderFilePath) ||
+			ExistingShaderText != PreparedLibrary.ShaderText)
+		{
+			if (!FFileHelper::SaveStringToFile(PreparedLibrary.ShaderText, *ShaderFilePath))
+			{
+				FHLSLMaterialMessages::ShowError(TEXT("Failed to write %s"), *ShaderFilePath);
+				return false;
+			}
+		}
+	}
+
+	Library.MaterialFunctions.RemoveAll([&](TSoftObjectPtr<UMaterialFunction> InFunction)
+	{
+		return !InFunction.LoadSynchronous();
+	});
+
+	const TSharedRef<FHLSLMaterialGenerationJob> Job = MakeShared<FHLSLMaterialGenerationJob>(Library);
+	Job->IncludeFilePaths = MoveTemp(PreparedLibrary.IncludeFilePaths);
+	Job->AdditionalDefines = MoveTemp(PreparedLibrary.AdditionalDefines);
+	Job->Structs = MoveTemp(PreparedLibrary.Structs);
+	Job->Functions = MoveTemp(PreparedLibrary.Functions);
+
+	if (bSynchronous || IsRunningCommandlet())
+	{
+		return Job->RunSynchronously();
+	}
+
+	// Spread over several frames so that large libraries don't freeze the editor
+	FHLSLMaterialGenerationJob::Start(Job);
+	return true;
+}
+
+bool FHLSLMaterialFunctionLibraryEditor::Prepare(UHLSLMaterialFunctionLibrary& Library, const FString& Text, FPreparedLibrary& OutLibrary)
+{
+	FHLSLMaterialMessages::FLibraryScope Scope(Library);
+
+	const FString FullPath = Library.GetFilePath();
+
 	FString BaseHash;
+	FString IncludesHash;
 	TArray<FString> IncludeFilePaths;
 	for (const FHLSLMaterialParser::FInclude& Include : FHLSLMaterialParser::GetIncludes(FullPath, Text))
 	{
 		IncludeFilePaths.Add(Include.VirtualPath);
 
-		FString IncludeText;
-		if (TryLoadFileToString(IncludeText, Include.DiskPath))
+		TUniquePtr<FHLSLMaterialSourceFile> IncludeFile;
 		{
-			BaseHash += FHLSLMaterialUtilities::HashString(IncludeText);
+			HLSL_TIMING_SCOPE(LoadFile, Library, Include.VirtualPath);
+			IncludeFile = FHLSLMaterialSourceFile::Open(Include.DiskPath);
+		}
+
+		if (IncludeFile)
+		{
+			// Includes are only hashed, no need to decode them
+			HLSL_TIMING_SCOPE(Hash, Library, Include.VirtualPath);
+			IncludesHash += IncludeFile->Hash().ToString();
 		}
 		else
 		{
-			FHLSLMaterialMessages::ShowError(TEXT("Invalid include: %s"), *Include.VirtualPath);
+			FHLSLMaterialMessages::ShowErrorAtLine(Include.Line, TEXT("Invalid include: %s"), *Include.VirtualPath);
 		}
 	}
+	BaseHash += IncludesHash;
 
 	TArray<FCustomDefine> AdditionalDefines = FHLSLMaterialParser::GetDefines(Text);
 	AdditionalDefines.Add({ "ENGINE_VERSION", FString::FromInt(ENGINE_VERSION) });
 
+	const FHLSLMaterialBuildProfileSettings& BuildProfile = Library.GetBuildProfileSettings(UHLSLMaterialFunctionLibrary::GetActiveBuildProfile());
+	for (const FCustomDefine& ProfileDefine : BuildProfile.Defines)
+	{
+		AdditionalDefines.RemoveAll([&](const FCustomDefine& Define)
+		{
+			return Define.DefineName == ProfileDefine.DefineName;
+		});
+		AdditionalDefines.Add(ProfileDefine);
+	}
+	AdditionalDefines.Add({ "HLSL_DEBUG_ONLY", BuildProfile.bStripDebugOnly ? "0" : "1" });
+
+	if (Library.bDynamicBools)
+	{
+		// Make sure toggling the option regenerates the functions
+		BaseHash += "DynamicBools";
+	}
+
+	if (Library.bCanonicalCode)
+	{
+		// Make sure toggling the option regenerates the functions
+		BaseHash += "Canonical";
+
+		for (FCustomDefine& Define : AdditionalDefines)
+		{
+			Define.DefineValue = FHLSLMaterialParser::CanonicalizeCode(Define.DefineValue).TrimEnd();
+		}
+
+		if (!IncludesHash.IsEmpty())
+		{
+			// The hash comment is stripped from the code, but materials still need to be recompiled when an include changes
+			AdditionalDefines.Add({ "HLSL_INCLUDES_HASH", FHLSLMaterialUtilities::HashString(IncludesHash) });
+		}
+	}
+
 	for (const FCustomDefine& Define : AdditionalDefines)
 	{
 		BaseHash += FHLSLMaterialUtilities::HashString(Define.DefineName);
@@ -135,11 +314,14 @@ void FHLSLMaterialFunctionLibraryEditor::Generate(UHLSLMaterialFunctionLibrary&
 	TArray<FHLSLMaterialFunction> Functions;
 	TArray<FString> Structs;
 	{
-		const FString Error = FHLSLMaterialParser::Parse(Library, Text, Functions, Structs);
+		HLSL_TIMING_SCOPE(Parse, Library);
+
+		int32 ErrorLine = 0;
+		const FString Error = FHLSLMaterialParser::Parse(Library, Text, Functions, Structs, ErrorLine);
 		if (!Error.IsEmpty())
 		{
-			FHLSLMaterialMessages::ShowError(TEXT("Parsing failed: %s"), *Error);
-			return;
+			FHLSLMaterialMessages::ShowErrorAtLine(ErrorLine, TEXT("Parsing failed: %s"), *Error);
+			return false;
 		}
 	}
 
@@ -148,29 +330,63 @@ void FHLSLMaterialFunctionLibraryEditor::Generate(UHLSLMaterialFunctionLibrary&
 		BaseHash += Struct;
 	}
 
-	Library.MaterialFunctions.RemoveAll([&](TSoftObjectPtr<UMaterialFunction> InFunction)
+	if (BuildProfile.bStripDebugOnly)
 	{
-		return !InFunction.LoadSynchronous();
-	});
-	
-	FMaterialUpdateContext UpdateContext;
-	for (FHLSLMaterialFunction Function : Functions)
+		// Before hashing & writing the shader file, so that the stripped code never ends up in any shader
+		FHLSLMaterialFunctionGenerator::StripDebugOnlyFunctions(Functions);
+	}
+
+	if (Library.bGenerateShaderFile)
 	{
-		Function.HashedString = Function.GenerateHashedString(BaseHash);
-		
-		const FString Error = FHLSLMaterialFunctionGenerator::GenerateFunction(
-			Library, 
-			IncludeFilePaths, 
+		FString ShaderText;
+		TArray<FHLSLMaterialFunction> ExportedFunctions;
+		const FString Error = FHLSLMaterialFunctionGenerator::GenerateShaderFile(
+			Library,
+			IncludeFilePaths,
 			AdditionalDefines,
 			Structs,
-			Function,
-			UpdateContext);
+			Functions,
+			ShaderText,
+			ExportedFunctions);
 
 		if (!Error.IsEmpty())
 		{
-			FHLSLMaterialMessages::ShowError(TEXT("Function %s: %s"), *Function.Name, *Error);
+			FHLSLMaterialMessages::ShowError(TEXT("Generating shader file failed: %s"), *Error);
+			return false;
+		}
+
+		OutLibrary.ShaderPath = Library.GetGeneratedShaderPath();
+
+		// Everything is in the shader file now, but each function is only hashed with what it can reach: its own code,
+		// the includes, defines & structs already in BaseHash, and the helpers. Editing a function doesn't dirty all the others
+		// The generator adds the per function hash define, see GenerateFunction
+		for (const FHLSLMaterialFunction& Function : Functions)
+		{
+			if (!ExportedFunctions.ContainsByPredicate([&](const FHLSLMaterialFunction& ExportedFunction) { return ExportedFunction.Name == Function.Name; }))
+			{
+				BaseHash += Function.GenerateHashedString({});
+			}
 		}
+		IncludeFilePaths = { OutLibrary.ShaderPath };
+		AdditionalDefines.Reset();
+		Structs.Reset();
+		Functions = MoveTemp(ExportedFunctions);
+		OutLibrary.ShaderText = MoveTemp(ShaderText);
+	}
+
+	for (FHLSLMaterialFunction& Function : Functions)
+	{
+		HLSL_TIMING_SCOPE(Hash, Library, Function.Name);
+		Function.HashedString = Function.GenerateHashedString(BaseHash);
 	}
+
+	OutLibrary.IncludeFilePaths = MoveTemp(IncludeFilePaths);
+	OutLibrary.AdditionalDefines = MoveTemp(AdditionalDefines);
+	OutLibrary.Structs = MoveTemp(Structs);
+	OutLibrary.Functions = MoveTemp(Functions);
+	OutLibrary.BaseHash = MoveTemp(BaseHash);
+
+	return true;
 }
 
 ///////////////////////////////////////////////////////////////////////////////
@@ -179,22 +395,13 @@ void FHLSLMaterialFunctionLibraryEditor::Generate(UHLSLMaterialFunctionLibrary&
 
 bool FHLSLMaterialFunctionLibraryEditor::TryLoadFileToString(FString& Text, const FString& FullPath)
 {
-	if (!FPaths::FileExists(FullPath))
+	// Mapped & decoded in a single pass, line endings are normalized to \n
+	const TUniquePtr<FHLSLMaterialSourceFile> File = FHLSLMaterialSourceFile::Open(FullPath);
+	if (!File)
 	{
 		return false;
 	}
 
-	if (!FFileHelper::LoadFileToString(Text, *FullPath))
-	{
-		// Wait and retry in case the text editor has locked the file
-		FPlatformProcess::Sleep(0.1f);
-
-		if (!FFileHelper::LoadFileToString(Text, *FullPath))
-		{
-			UE_LOG(LogHLSLMaterial, Error, TEXT("Failed to read %s"), *FullPath);
-			return false;
-		}
-	}
-
+	Text = File->ToString();
 	return true;
 }
\ No newline at end of file
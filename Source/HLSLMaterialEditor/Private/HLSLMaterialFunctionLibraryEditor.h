@@ -3,6 +3,8 @@
 #pragma once
 
 #include "CoreMinimal.h"
+#include "HLSLMaterialFunction.h"
+#include "Materials/MaterialExpressionCustom.h"
 
 class UHLSLMaterialFunctionLibrary;
 
@@ -12,8 +14,31 @@ public:
 	static void Register();
 
 	static TSharedRef<FVirtualDestructor> CreateWatcher(UHLSLMaterialFunctionLibrary& Library);
-	static void Generate(UHLSLMaterialFunctionLibrary& Library);
+	// Functions are generated over several frames, unless bSynchronous is true or running a commandlet
+	// Returns false if the library couldn't be generated, or if any function failed when generated synchronously
+	static bool Generate(UHLSLMaterialFunctionLibrary& Library, bool bSynchronous = false);
+
+	struct FPreparedLibrary
+	{
+		TArray<FString> IncludeFilePaths;
+		TArray<FCustomDefine> AdditionalDefines;
+		TArray<FString> Structs;
+		// With their HashedString set
+		TArray<FHLSLMaterialFunction> Functions;
+		FString BaseHash;
+
+		// Only set if bGenerateShaderFile
+		FString ShaderPath;
+		FString ShaderText;
+	};
+	// Parses & hashes the library text & its includes, without writing any file nor asset
+	// Errors are shown through FHLSLMaterialMessages. Returns false if no function can be generated
+	static bool Prepare(UHLSLMaterialFunctionLibrary& Library, const FString& Text, FPreparedLibrary& OutLibrary);
 
-private:
 	static bool TryLoadFileToString(FString& Text, const FString& FullPath);
+
+private:
+	// Cooking with -HLSLMaterialProfile: regenerate all the libraries in memory with that profile before anything is compiled
+	// The cook is stopped if any library fails, as it would otherwise ship the code of the Editor profile
+	static void RegenerateForCook();
 };
\ No newline at end of file
@@ -0,0 +1,280 @@
+// Copyright Phyronnaz
+
+#include "HLSLMaterialGenerationJob.h"
+#include "HLSLMaterialFunctionGenerator.h"
+#include "HLSLMaterialFunctionLibrary.h"
+#include "HLSLMaterialUtilities.h"
+#include "HLSLMaterialMessages.h"
+#include "HLSLMaterialTimings.h"
+
+#include "Containers/Ticker.h"
+#include "Widgets/Notifications/SNotificationList.h"
+#include "Framework/Notifications/NotificationManager.h"
+
+TArray<TSharedPtr<FHLSLMaterialGenerationJob>> FHLSLMaterialGenerationJob::Jobs;
+
+FHLSLMaterialGenerationJob::FHLSLMaterialGenerationJob(UHLSLMaterialFunctionLibrary& Library)
+	: WeakLibrary(&Library)
+	, LibraryName(Library.GetName())
+{
+}
+
+void FHLSLMaterialGenerationJob::Start(const TSharedRef<FHLSLMaterialGenerationJob>& Job)
+{
+	check(IsInGameThread());
+
+	// The previous job is outdated, but keep what it already generated
+	for (const TSharedPtr<FHLSLMaterialGenerationJob>& OtherJob : TArray<TSharedPtr<FHLSLMaterialGenerationJob>>(Jobs))
+	{
+		if (OtherJob->WeakLibrary == Job->WeakLibrary)
+		{
+			OtherJob->bSuperseded = true;
+			OtherJob->Cancel();
+			OtherJob->Finish();
+			Jobs.Remove(OtherJob);
+		}
+	}
+
+	Jobs.Add(Job);
+
+	// Unbound once the job is destroyed, which removes the ticker
+	UE_500_SWITCH(FTicker, FTSTicker)::GetCoreTicker().AddTicker(FTickerDelegate::CreateSP(Job, &FHLSLMaterialGenerationJob::Tick));
+}
+
+bool FHLSLMaterialGenerationJob::RunSynchronously()
+{
+	while (!bCancelled && NextFunction < Functions.Num())
+	{
+		GenerateNextFunction();
+	}
+
+	Finish();
+
+	return !bCancelled && FailedFunctions.Num() == 0;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+///////////////////////////////////////////////////////////////////////////////
+///////////////////////////////////////////////////////////////////////////////
+
+bool FHLSLMaterialGenerationJob::Tick(float DeltaTime)
+{
+	const TSharedRef<FHLSLMaterialGenerationJob> KeepAlive = AsShared();
+
+	const double StartTime = FPlatformTime::Seconds();
+	while (!bCancelled &&
+		NextFunction < Functions.Num() &&
+		FPlatformTime::Seconds() - StartTime < TimeBudget)
+	{
+		GenerateNextFunction();
+	}
+
+	if (!bCancelled && NextFunction < Functions.Num())
+	{
+		if (!Notification && !IsRunningCommandlet())
+		{
+			// Only show progress for jobs that don't complete in a single frame
+			FNotificationInfo Info(GetProgressText());
+			Info.bFireAndForget = false;
+			Info.ButtonDetails.Add(FNotificationButtonInfo(
+				INVTEXT("Cancel"),
+				INVTEXT("Stop generating the functions. Functions already generated are kept"),
+				FSimpleDelegate::CreateSP(this, &FHLSLMaterialGenerationJob::Cancel),
+				SNotificationItem::CS_Pending));
+
+			Notification = FSlateNotificationManager::Get().AddNotification(Info);
+			if (Notification)
+			{
+				Notification->SetCompletionState(SNotificationItem::CS_Pending);
+			}
+		}
+
+		if (Notification)
+		{
+			Notification->SetText(GetProgressText());
+		}
+
+		return true;
+	}
+
+	Finish();
+	Jobs.Remove(KeepAlive);
+
+	return false;
+}
+
+void FHLSLMaterialGenerationJob::Cancel()
+{
+	bCancelled = true;
+}
+
+void FHLSLMaterialGenerationJob::GenerateNextFunction()
+{
+	UHLSLMaterialFunctionLibrary* Library = WeakLibrary.Get();
+	if (!Library)
+	{
+		// Library was deleted
+		bCancelled = true;
+		return;
+	}
+
+	FHLSLMaterialMessages::FLibraryScope Scope(*Library);
+
+	const FHLSLMaterialFunction& Function = Functions[NextFunction++];
+
+	HLSL_TIMING_SCOPE(GenerateFunction, *Library, Function.Name);
+
+	bool bUpdated = false;
+	bool bCodeOnly = false;
+	const FString Error = FHLSLMaterialFunctionGenerator::GenerateFunction(
+		*Library,
+		IncludeFilePaths,
+		AdditionalDefines,
+		Structs,
+		Function,
+		bUpdated,
+		bCodeOnly);
+
+	// A function can be both updated & failed, eg if it's over its instruction budget
+	if (bUpdated)
+	{
+		UpdatedFunctions.Add(Function.Name);
+		bGraphsChanged |= !bCodeOnly;
+	}
+
+	if (!Error.IsEmpty())
+	{
+		// Not shown right away, the summary lists the errors
+		const FString Message = FString::Printf(TEXT("%s:%d: Function %s: %s"), *Library->File.FilePath, Function.DeclarationLine, *Function.Name, *Error);
+		UE_LOG(LogHLSLMaterial, Error, TEXT("%s"), *Message);
+		FailedFunctions.Add(Function.Name);
+		Errors.Add(Message);
+	}
+	else if (!bUpdated)
+	{
+		NumUnchanged++;
+	}
+}
+
+void FHLSLMaterialGenerationJob::Finish()
+{
+	if (bFinished)
+	{
+		return;
+	}
+	bFinished = true;
+
+	UHLSLMaterialFunctionLibrary* Library = WeakLibrary.Get();
+	if (Library && UpdatedFunctions.Num() > 0)
+	{
+		// Only created now: it recreates the render state of all components, which would otherwise
+		// leave the viewports empty for the whole duration of the job
+		TOptional<FMaterialUpdateContext> UpdateContext;
+		UpdateContext.Emplace();
+
+		FHLSLMaterialFunctionGenerator::RefreshMaterialEditors(*Library, UpdateContext.GetValue(), bGraphsChanged);
+
+		// Recreates the render state of the updated materials. Shader compilation itself is asynchronous
+		HLSL_TIMING_SCOPE(MaterialUpdate, *Library);
+		UpdateContext.Reset();
+	}
+
+	FHLSLMaterialTimings::Flush();
+
+	if (bSuperseded)
+	{
+		// Silent: the new job reports on the whole library, including the errors of this one that still apply
+		UE_LOG(LogHLSLMaterial, Log, TEXT("%s"), *GetSummary());
+
+		if (Notification)
+		{
+			Notification->SetCompletionState(SNotificationItem::CS_None);
+			Notification->ExpireAndFadeout();
+			Notification.Reset();
+		}
+		return;
+	}
+
+	const bool bFailed = bCancelled || FailedFunctions.Num() > 0;
+	const FString Summary = GetSummary();
+
+	if (bFailed)
+	{
+		UE_LOG(LogHLSLMaterial, Error, TEXT("%s"), *Summary);
+	}
+	else
+	{
+		UE_LOG(LogHLSLMaterial, Log, TEXT("%s"), *Summary);
+	}
+
+	if (!Notification &&
+		!IsRunningCommandlet() &&
+		(bFailed || UpdatedFunctions.Num() > 0))
+	{
+		FNotificationInfo Info(FText::FromString(Summary));
+		Info.bFireAndForget = false;
+		Notification = FSlateNotificationManager::Get().AddNotification(Info);
+	}
+
+	if (Notification)
+	{
+		Notification->SetText(FText::FromString(Summary));
+		Notification->SetCompletionState(bFailed ? SNotificationItem::CS_Fail : SNotificationItem::CS_Success);
+		Notification->SetExpireDuration(bFailed ? 10.f : 5.f);
+		Notification->ExpireAndFadeout();
+		Notification.Reset();
+	}
+}
+
+///////////////////////////////////////////////////////////////////////////////
+///////////////////////////////////////////////////////////////////////////////
+///////////////////////////////////////////////////////////////////////////////
+
+FText FHLSLMaterialGenerationJob::GetProgressText() const
+{
+	return FText::FromString(FString::Printf(TEXT("%s: generating functions (%d/%d)"), *LibraryName, NextFunction, Functions.Num()));
+}
+
+FString FHLSLMaterialGenerationJob::GetSummary() const
+{
+	// eg 2 updated (A, B)
+	const auto Format = [](int32 Num, const TCHAR* State, const TArray<FString>& Names)
+	{
+		FString Result = FString::Printf(TEXT("%d %s"), Num, State);
+		if (Names.Num() > 0 && Names.Num() <= 5)
+		{
+			Result += " (" + FString::Join(Names, TEXT(", ")) + ")";
+		}
+		return Result;
+	};
+
+	FString Summary = LibraryName + ": ";
+	if (bSuperseded)
+	{
+		Summary += "superseded, ";
+	}
+	else if (bCancelled)
+	{
+		Summary += "cancelled, ";
+	}
+	Summary += Format(UpdatedFunctions.Num(), TEXT("updated"), UpdatedFunctions) + ", ";
+	Summary += Format(NumUnchanged, TEXT("unchanged"), {}) + ", ";
+	Summary += Format(FailedFunctions.Num(), TEXT("failed"), FailedFunctions);
+
+	if (bCancelled)
+	{
+		Summary += FString::Printf(TEXT(", %d skipped"), Functions.Num() - NextFunction);
+	}
+
+	constexpr int32 MaxErrors = 5;
+	for (int32 Index = 0; Index < FMath::Min(Errors.Num(), MaxErrors); Index++)
+	{
+		Summary += "\n" + Errors[Index];
+	}
+	if (Errors.Num() > MaxErrors)
+	{
+		Summary += FString::Printf(TEXT("\n%d more errors in the log"), Errors.Num() - MaxErrors);
+	}
+
+	return Summary;
+}
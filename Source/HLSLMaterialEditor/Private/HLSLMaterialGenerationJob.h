@@ -0,0 +1,61 @@
+// Copyright Phyronnaz
+
+#pragma once
+
+#include "CoreMinimal.h"
+#include "MaterialShared.h"
+#include "HLSLMaterialFunction.h"
+
+class SNotificationItem;
+class UHLSLMaterialFunctionLibrary;
+
+// Generates the functions of a library within a per-frame time budget, with a single progress notification
+class FHLSLMaterialGenerationJob : public TSharedFromThis<FHLSLMaterialGenerationJob>
+{
+public:
+	TArray<FString> IncludeFilePaths;
+	TArray<FCustomDefine> AdditionalDefines;
+	TArray<FString> Structs;
+	// With their HashedString set
+	TArray<FHLSLMaterialFunction> Functions;
+
+	explicit FHLSLMaterialGenerationJob(UHLSLMaterialFunctionLibrary& Library);
+
+	// Silently cancels the job already running for the same library, if any
+	static void Start(const TSharedRef<FHLSLMaterialGenerationJob>& Job);
+	// Generates all the functions right away, eg in commandlets. Returns false if any function failed
+	bool RunSynchronously();
+
+private:
+	// Max time spent generating functions per frame, in seconds
+	static constexpr double TimeBudget = 0.02;
+
+	static TArray<TSharedPtr<FHLSLMaterialGenerationJob>> Jobs;
+
+	const TWeakObjectPtr<UHLSLMaterialFunctionLibrary> WeakLibrary;
+	const FString LibraryName;
+
+	TSharedPtr<SNotificationItem> Notification;
+
+	int32 NextFunction = 0;
+	bool bCancelled = false;
+	// Cancelled because the library is generated again, rather than by the user
+	bool bSuperseded = false;
+	bool bFinished = false;
+
+	TArray<FString> UpdatedFunctions;
+	// Whether any updated function had its graph rebuilt, rather than only its code patched
+	bool bGraphsChanged = false;
+	TArray<FString> FailedFunctions;
+	// eg MyFile.hlsl:12: Function A: Invalid arguments syntax
+	TArray<FString> Errors;
+	int32 NumUnchanged = 0;
+
+	bool Tick(float DeltaTime);
+	void Cancel();
+	void GenerateNextFunction();
+	void Finish();
+
+	FText GetProgressText() const;
+	FString GetSummary() const;
+};
@@ -0,0 +1,472 @@
+// Copyright Phyronnaz
+
+#include "HLSLMaterialLanguageServerCommandlet.h"
+#include "HLSLMaterialUtilities.h"
+#include "HLSLMaterialMessages.h"
+#include "HLSLMaterialFunction.h"
+#include "HLSLMaterialFunctionLibrary.h"
+#include "HLSLMaterialFunctionGenerator.h"
+#include "HLSLMaterialFunctionLibraryEditor.h"
+#include "Misc/OutputDeviceConsole.h"
+#include "Sockets.h"
+#include "IPAddress.h"
+#include "SocketSubsystem.h"
+#include "Serialization/JsonReader.h"
+#include "Serialization/JsonWriter.h"
+#include "Serialization/JsonSerializer.h"
+#include "Policies/CondensedJsonPrintPolicy.h"
+
+#include <stdio.h>
+#if PLATFORM_WINDOWS
+#include <io.h>
+#include <fcntl.h>
+#else
+#include <unistd.h>
+#endif
+
+// Null when using stdio
+static FSocket* Socket = nullptr;
+// stdout when using stdio, duplicated so that nothing else writes to it
+static FILE* Output = nullptr;
+
+UHLSLMaterialLanguageServerCommandlet::UHLSLMaterialLanguageServerCommandlet()
+{
+	IsClient = false;
+	IsServer = false;
+	IsEditor = true;
+	// stdout is used by the protocol
+	LogToConsole = false;
+}
+
+int32 UHLSLMaterialLanguageServerCommandlet::Main(const FString& Params)
+{
+	if (GLogConsole)
+	{
+		GLog->RemoveOutputDevice(GLogConsole);
+	}
+
+	int32 Port = 0;
+	if (FParse::Value(*Params, TEXT("socket="), Port))
+	{
+		// The client is listening, eg VS Code socket transports which pass --socket=Port
+		ISocketSubsystem* SocketSubsystem = ISocketSubsystem::Get(PLATFORM_SOCKETSUBSYSTEM);
+
+		bool bIsValid = false;
+		const TSharedRef<FInternetAddr> Address = SocketSubsystem->CreateInternetAddr();
+		Address->SetIp(TEXT("127.0.0.1"), bIsValid);
+		Address->SetPort(Port);
+
+		Socket = SocketSubsystem->CreateSocket(NAME_Stream, TEXT("HLSLMaterialLanguageServer"), false);
+		if (!Socket || !Socket->Connect(*Address))
+		{
+			UE_LOG(LogHLSLMaterial, Error, TEXT("Failed to connect to the client on port %d"), Port);
+			return 1;
+		}
+	}
+	else
+	{
+		// Anything the engine logged to stdout would corrupt the protocol
+		if (FParse::Param(FCommandLine::Get(), TEXT("stdout")) ||
+			FParse::Param(FCommandLine::Get(), TEXT("FullStdOutLogOutput")))
+		{
+			UE_LOG(LogHLSLMaterial, Error, TEXT("-stdout can't be used with the stdio transport, as the protocol uses stdout. Remove it or use -socket=Port"));
+			return 1;
+		}
+
+#if PLATFORM_WINDOWS
+		// Content-Length is in bytes, don't let the CRT convert line endings
+		_setmode(_fileno(stdin), _O_BINARY);
+		_setmode(_fileno(stdout), _O_BINARY);
+#endif
+
+		// Keep a private handle on stdout for the protocol, and send whatever else is printed to stdout to stderr
+		fflush(stdout);
+#if PLATFORM_WINDOWS
+		Output = _fdopen(_dup(_fileno(stdout)), "wb");
+		_dup2(_fileno(stderr), _fileno(stdout));
+#else
+		Output = fdopen(dup(fileno(stdout)), "w");
+		dup2(fileno(stderr), fileno(stdout));
+#endif
+
+		if (!Output)
+		{
+			UE_LOG(LogHLSLMaterial, Error, TEXT("Failed to duplicate stdout"));
+			return 1;
+		}
+	}
+
+	UE_LOG(LogHLSLMaterial, Log, TEXT("Language server started"));
+
+	FString Content;
+	while (!bExit && ReadMessage(Content))
+	{
+		TSharedPtr<FJsonObject> Message;
+		if (!FJsonSerializer::Deserialize(TJsonReaderFactory<>::Create(Content), Message) || !Message)
+		{
+			// Parse error
+			WriteError(MakeShared<FJsonValueNull>(), -32700, "Invalid JSON");
+			continue;
+		}
+
+		HandleMessage(*Message);
+	}
+
+	for (const auto& It : Libraries)
+	{
+		It.Value->RemoveFromRoot();
+	}
+
+	if (Socket)
+	{
+		Socket->Close();
+		ISocketSubsystem::Get(PLATFORM_SOCKETSUBSYSTEM)->DestroySocket(Socket);
+		Socket = nullptr;
+	}
+	if (Output)
+	{
+		fclose(Output);
+		Output = nullptr;
+	}
+
+	UE_LOG(LogHLSLMaterial, Log, TEXT("Language server stopped"));
+
+	// As per the spec, exiting without a shutdown request is an error
+	return bShutdown ? 0 : 1;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+///////////////////////////////////////////////////////////////////////////////
+///////////////////////////////////////////////////////////////////////////////
+
+void UHLSLMaterialLanguageServerCommandlet::HandleMessage(const FJsonObject& Message)
+{
+	// Responses to our requests have no method, and are ignored
+	FString Method;
+	Message.TryGetStringField(TEXT("method"), Method);
+	const TSharedPtr<FJsonValue> Id = Message.TryGetField(TEXT("id"));
+
+	const TSharedPtr<FJsonObject>* ParamsPtr = nullptr;
+	Message.TryGetObjectField(TEXT("params"), ParamsPtr);
+	const TSharedRef<FJsonObject> Params = ParamsPtr && *ParamsPtr ? ParamsPtr->ToSharedRef() : MakeShared<FJsonObject>();
+
+	FString Uri;
+	FString Text;
+	const TSharedPtr<FJsonObject>* TextDocument = nullptr;
+	if (Params->TryGetObjectField(TEXT("textDocument"), TextDocument) && *TextDocument)
+	{
+		(*TextDocument)->TryGetStringField(TEXT("uri"), Uri);
+		(*TextDocument)->TryGetStringField(TEXT("text"), Text);
+	}
+
+	if (Method == TEXT("initialize"))
+	{
+		const TSharedRef<FJsonObject> TextDocumentSync = MakeShared<FJsonObject>();
+		TextDocumentSync->SetBoolField(TEXT("openClose"), true);
+		// Full document sync: HLSL libraries are small, and parsing them is much cheaper than diffing
+		TextDocumentSync->SetNumberField(TEXT("change"), 1);
+
+		const TSharedRef<FJsonObject> Capabilities = MakeShared<FJsonObject>();
+		Capabilities->SetObjectField(TEXT("textDocumentSync"), TextDocumentSync);
+
+		const TSharedRef<FJsonObject> ServerInfo = MakeShared<FJsonObject>();
+		ServerInfo->SetStringField(TEXT("name"), TEXT("HLSLMaterial"));
+
+		const TSharedRef<FJsonObject> Result = MakeShared<FJsonObject>();
+		Result->SetObjectField(TEXT("capabilities"), Capabilities);
+		Result->SetObjectField(TEXT("serverInfo"), ServerInfo);
+
+		WriteResponse(Id, MakeShared<FJsonValueObject>(Result));
+	}
+	else if (Method == TEXT("shutdown"))
+	{
+		bShutdown = true;
+		WriteResponse(Id, MakeShared<FJsonValueNull>());
+	}
+	else if (Method == TEXT("exit"))
+	{
+		bExit = true;
+	}
+	else if (Method == TEXT("textDocument/didOpen"))
+	{
+		PublishDiagnostics(Uri, Text);
+	}
+	else if (Method == TEXT("textDocument/didChange"))
+	{
+		// With full sync, the last change has the whole text
+		const TArray<TSharedPtr<FJsonValue>>* ContentChanges = nullptr;
+		if (Params->TryGetArrayField(TEXT("contentChanges"), ContentChanges) && ContentChanges->Num() > 0)
+		{
+			const TSharedPtr<FJsonObject> Change = ContentChanges->Last()->AsObject();
+			if (Change && Change->TryGetStringField(TEXT("text"), Text))
+			{
+				PublishDiagnostics(Uri, Text);
+			}
+		}
+	}
+	else if (Method == TEXT("textDocument/didClose"))
+	{
+		if (UHLSLMaterialFunctionLibrary* Library = Libraries.FindRef(Uri))
+		{
+			Library->RemoveFromRoot();
+			Libraries.Remove(Uri);
+		}
+
+		// Clear the diagnostics of the closed file
+		WriteDiagnostics(Uri, {});
+	}
+	else if (Id.IsValid())
+	{
+		// Requests need an answer, notifications we don't handle are ignored
+		WriteError(Id, -32601, "Method not found: " + Method);
+	}
+}
+
+void UHLSLMaterialLanguageServerCommandlet::PublishDiagnostics(const FString& Uri, const FString& Text)
+{
+	UHLSLMaterialFunctionLibrary*& Library = Libraries.FindOrAdd(Uri);
+	if (!Library)
+	{
+		// Transient library with the default settings, so that includes are resolved relative to the file
+		Library = NewObject<UHLSLMaterialFunctionLibrary>(GetTransientPackage(), NAME_None, RF_Transient);
+		Library->File.FilePath = UriToFilePath(Uri);
+		Library->bUpdateOnFileChange = false;
+		Library->AddToRoot();
+	}
+
+	const double StartTime = FPlatformTime::Seconds();
+
+	FHLSLMaterialMessages::FCaptureScope CaptureScope;
+	{
+		FHLSLMaterialMessages::FLibraryScope LibraryScope(*Library);
+
+		FHLSLMaterialFunctionLibraryEditor::FPreparedLibrary PreparedLibrary;
+		if (FHLSLMaterialFunctionLibraryEditor::Prepare(*Library, Text, PreparedLibrary))
+		{
+			for (const FHLSLMaterialFunction& Function : PreparedLibrary.Functions)
+			{
+				FHLSLMaterialFunctionGenerator::FAnalysis Analysis;
+				const FString Error = FHLSLMaterialFunctionGenerator::AnalyzeFunction(*Library, Function, Analysis);
+				if (!Error.IsEmpty())
+				{
+					FHLSLMaterialMessages::ShowErrorAtLine(Function.DeclarationLine, TEXT("Function %s: %s"), *Function.Name, *Error);
+				}
+			}
+		}
+	}
+
+	TArray<FString> Lines;
+	Text.ParseIntoArray(Lines, TEXT("\n"), false);
+
+	TArray<TSharedPtr<FJsonValue>> Diagnostics;
+	for (const FHLSLMaterialMessages::FMessage& Message : CaptureScope.Messages)
+	{
+		// LSP lines are 0-based. Messages without a line are shown on the first one
+		const int32 Line = FMath::Max(Message.Line - 1, 0);
+
+		const TSharedRef<FJsonObject> Start = MakeShared<FJsonObject>();
+		Start->SetNumberField(TEXT("line"), Line);
+		Start->SetNumberField(TEXT("character"), 0);
+
+		const TSharedRef<FJsonObject> End = MakeShared<FJsonObject>();
+		End->SetNumberField(TEXT("line"), Line);
+		End->SetNumberField(TEXT("character"), Lines.IsValidIndex(Line) ? Lines[Line].TrimEnd().Len() : 0);
+
+		const TSharedRef<FJsonObject> Range = MakeShared<FJsonObject>();
+		Range->SetObjectField(TEXT("start"), Start);
+		Range->SetObjectField(TEXT("end"), End);
+
+		const TSharedRef<FJsonObject> Diagnostic = MakeShared<FJsonObject>();
+		Diagnostic->SetObjectField(TEXT("range"), Range);
+		// 1 = Error, 2 = Warning
+		Diagnostic->SetNumberField(TEXT("severity"), Message.bIsError ? 1 : 2);
+		Diagnostic->SetStringField(TEXT("source"), TEXT("HLSLMaterial"));
+		Diagnostic->SetStringField(TEXT("message"), Message.Text);
+		Diagnostics.Add(MakeShared<FJsonValueObject>(Diagnostic));
+	}
+
+	UE_LOG(LogHLSLMaterial, Log, TEXT("%s: %d diagnostics in %.2fms"), *Uri, Diagnostics.Num(), (FPlatformTime::Seconds() - StartTime) * 1000);
+
+	WriteDiagnostics(Uri, Diagnostics);
+}
+
+///////////////////////////////////////////////////////////////////////////////
+///////////////////////////////////////////////////////////////////////////////
+///////////////////////////////////////////////////////////////////////////////
+
+bool UHLSLMaterialLanguageServerCommandlet::ReadMessage(FString& OutContent)
+{
+	// Headers are ASCII lines ending with \r\n, followed by an empty line
+	int32 ContentLength = -1;
+	while (true)
+	{
+		TArray<ANSICHAR> Line;
+		ANSICHAR Char = 0;
+		while (Char != '\n')
+		{
+			if (!Read(&Char, 1))
+			{
+				return false;
+			}
+			Line.Add(Char);
+		}
+		Line.Add(0);
+
+		FString Header = ANSI_TO_TCHAR(Line.GetData());
+		Header.TrimEndInline();
+
+		if (Header.IsEmpty())
+		{
+			if (ContentLength >= 0)
+			{
+				break;
+			}
+			continue;
+		}
+
+		if (Header.RemoveFromStart(TEXT("Content-Length:")))
+		{
+			ContentLength = FCString::Atoi(*Header.TrimStart());
+		}
+	}
+
+	TArray<ANSICHAR> Buffer;
+	Buffer.SetNumUninitialized(ContentLength);
+	if (!Read(Buffer.GetData(), ContentLength))
+	{
+		return false;
+	}
+
+	const FUTF8ToTCHAR Converter(Buffer.GetData(), Buffer.Num());
+	OutContent = FString(Converter.Length(), Converter.Get());
+	return true;
+}
+
+void UHLSLMaterialLanguageServerCommandlet::WriteMessage(const TSharedRef<FJsonObject>& Message)
+{
+	Message->SetStringField(TEXT("jsonrpc"), TEXT("2.0"));
+
+	FString Content;
+	FJsonSerializer::Serialize(Message, TJsonWriterFactory<TCHAR, TCondensedJsonPrintPolicy<TCHAR>>::Create(&Content));
+
+	const FTCHARToUTF8 Converter(*Content, Content.Len());
+	const FTCHARToUTF8 Header(*FString::Printf(TEXT("Content-Length: %d\r\n\r\n"), Converter.Length()));
+
+	Write(Header.Get(), Header.Length());
+	Write(Converter.Get(), Converter.Length());
+
+	if (Output)
+	{
+		fflush(Output);
+	}
+}
+
+bool UHLSLMaterialLanguageServerCommandlet::Read(ANSICHAR* Data, int32 Num)
+{
+	if (!Socket)
+	{
+		return fread(Data, 1, Num, stdin) == size_t(Num);
+	}
+
+	while (Num > 0)
+	{
+		int32 BytesRead = 0;
+		if (!Socket->Recv(reinterpret_cast<uint8*>(Data), Num, BytesRead) || BytesRead <= 0)
+		{
+			return false;
+		}
+		Data += BytesRead;
+		Num -= BytesRead;
+	}
+	return true;
+}
+
+void UHLSLMaterialLanguageServerCommandlet::Write(const ANSICHAR* Data, int32 Num)
+{
+	if (!Socket)
+	{
+		fwrite(Data, 1, Num, Output);
+		return;
+	}
+
+	while (Num > 0)
+	{
+		int32 BytesSent = 0;
+		if (!Socket->Send(reinterpret_cast<const uint8*>(Data), Num, BytesSent))
+		{
+			return;
+		}
+		Data += BytesSent;
+		Num -= BytesSent;
+	}
+}
+
+void UHLSLMaterialLanguageServerCommandlet::WriteDiagnostics(const FString& Uri, const TArray<TSharedPtr<FJsonValue>>& Diagnostics)
+{
+	const TSharedRef<FJsonObject> Params = MakeShared<FJsonObject>();
+	Params->SetStringField(TEXT("uri"), Uri);
+	Params->SetArrayField(TEXT("diagnostics"), Diagnostics);
+
+	const TSharedRef<FJsonObject> Notification = MakeShared<FJsonObject>();
+	Notification->SetStringField(TEXT("method"), TEXT("textDocument/publishDiagnostics"));
+	Notification->SetObjectField(TEXT("params"), Params);
+	WriteMessage(Notification);
+}
+
+void UHLSLMaterialLanguageServerCommandlet::WriteResponse(const TSharedPtr<FJsonValue>& Id, const TSharedPtr<FJsonValue>& Result)
+{
+	const TSharedRef<FJsonObject> Response = MakeShared<FJsonObject>();
+	Response->SetField(TEXT("id"), Id.IsValid() ? Id : MakeShared<FJsonValueNull>());
+	Response->SetField(TEXT("result"), Result);
+	WriteMessage(Response);
+}
+
+void UHLSLMaterialLanguageServerCommandlet::WriteError(const TSharedPtr<FJsonValue>& Id, int32 Code, const FString& ErrorMessage)
+{
+	const TSharedRef<FJsonObject> Error = MakeShared<FJsonObject>();
+	Error->SetNumberField(TEXT("code"), Code);
+	Error->SetStringField(TEXT("message"), ErrorMessage);
+
+	const TSharedRef<FJsonObject> Response = MakeShared<FJsonObject>();
+	Response->SetField(TEXT("id"), Id.IsValid() ? Id : MakeShared<FJsonValueNull>());
+	Response->SetObjectField(TEXT("error"), Error);
+	WriteMessage(Response);
+}
+
+FString UHLSLMaterialLanguageServerCommandlet::UriToFilePath(const FString& Uri)
+{
+	FString Path = Uri;
+	if (!Path.RemoveFromStart(TEXT("file://")))
+	{
+		return Path;
+	}
+
+	// Percent-decode, as bytes since escaped characters are UTF-8
+	TArray<ANSICHAR> Bytes;
+	const FTCHARToUTF8 Converter(*Path, Path.Len());
+	for (int32 Index = 0; Index < Converter.Length(); Index++)
+	{
+		const ANSICHAR Char = Converter.Get()[Index];
+		if (Char == '%' &&
+			Index + 2 < Converter.Length() &&
+			FChar::IsHexDigit(Converter.Get()[Index + 1]) &&
+			FChar::IsHexDigit(Converter.Get()[Index + 2]))
+		{
+			Bytes.Add(ANSICHAR(FParse::HexDigit(Converter.Get()[Index + 1]) * 16 + FParse::HexDigit(Converter.Get()[Index + 2])));
+			Index += 2;
+			continue;
+		}
+		Bytes.Add(Char);
+	}
+
+	const FUTF8ToTCHAR Decoded(Bytes.GetData(), Bytes.Num());
+	Path = FString(Decoded.Length(), Decoded.Get());
+
+	// file:///c:/Shaders -> c:/Shaders
+	if (Path.Len() >= 3 && Path[0] == TEXT('/') && Path[2] == TEXT(':'))
+	{
+		Path.RightChopInline(1);
+	}
+
+	return Path;
+}
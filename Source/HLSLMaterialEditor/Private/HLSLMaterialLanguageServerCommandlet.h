@@ -0,0 +1,53 @@
+// Copyright Phyronnaz
+
+#pragma once
+
+#include "CoreMinimal.h"
+#include "Dom/JsonObject.h"
+#include "Commandlets/Commandlet.h"
+#include "HLSLMaterialLanguageServerCommandlet.generated.h"
+
+class UHLSLMaterialFunctionLibrary;
+
+// Language server reporting the parser, signature & include errors of HLSL libraries as the file is edited,
+// without generating nor compiling anything. Speaks LSP JSON-RPC with full document sync, over stdin & stdout
+// or over a TCP connection to the client with -socket=Port
+//
+// UnrealEditor-Cmd MyProject -run=HLSLMaterialLanguageServer -nullrhi -unattended -nosplash
+//
+// With stdio, -stdout is rejected, and whatever is printed to stdout once the server is started goes to stderr.
+// The engine startup log is printed before that: on platforms echoing the log to the terminal (eg Linux), use -socket=Port
+// Documents are analyzed with the default library settings
+UCLASS()
+class UHLSLMaterialLanguageServerCommandlet : public UCommandlet
+{
+	GENERATED_BODY()
+
+public:
+	UHLSLMaterialLanguageServerCommandlet();
+
+	//~ Begin UCommandlet Interface
+	virtual int32 Main(const FString& Params) override;
+	//~ End UCommandlet Interface
+
+private:
+	// Document URI -> library used to analyze it
+	TMap<FString, UHLSLMaterialFunctionLibrary*> Libraries;
+	bool bShutdown = false;
+	bool bExit = false;
+
+	void HandleMessage(const FJsonObject& Message);
+	void PublishDiagnostics(const FString& Uri, const FString& Text);
+
+	// Message content without its headers. Returns false once the input is closed
+	static bool ReadMessage(FString& OutContent);
+	static bool Read(ANSICHAR* Data, int32 Num);
+	static void Write(const ANSICHAR* Data, int32 Num);
+	static void WriteMessage(const TSharedRef<FJsonObject>& Message);
+	static void WriteDiagnostics(const FString& Uri, const TArray<TSharedPtr<FJsonValue>>& Diagnostics);
+	static void WriteResponse(const TSharedPtr<FJsonValue>& Id, const TSharedPtr<FJsonValue>& Result);
+	static void WriteError(const TSharedPtr<FJsonValue>& Id, int32 Code, const FString& ErrorMessage);
+
+	// eg file:///c%3A/Shaders/MyFile.hlsl -> c:/Shaders/MyFile.hlsl
+	static FString UriToFilePath(const FString& Uri);
+};
@@ -0,0 +1,301 @@
+// Copyright Phyronnaz
+
+#include "HLSLMaterialManifestCommandlet.h"
+#include "HLSLMaterialUtilities.h"
+#include "HLSLMaterialMessages.h"
+#include "HLSLMaterialFunction.h"
+#include "HLSLMaterialFunctionLibrary.h"
+#include "HLSLMaterialFunctionGenerator.h"
+#include "HLSLMaterialFunctionLibraryEditor.h"
+#include "Misc/FileHelper.h"
+#include "Materials/MaterialExpressionTextureCoordinate.h"
+#include "AssetRegistry/AssetRegistryModule.h"
+
+UHLSLMaterialManifestCommandlet::UHLSLMaterialManifestCommandlet()
+{
+	IsClient = false;
+	IsServer = false;
+	IsEditor = true;
+	LogToConsole = true;
+}
+
+int32 UHLSLMaterialManifestCommandlet::Main(const FString& Params)
+{
+	FString OutputPath;
+	FParse::Value(*Params, TEXT("Output="), OutputPath);
+
+	TArray<UHLSLMaterialFunctionLibrary*> Libraries;
+	{
+		FString FilesString;
+		FString LibrariesString;
+		if (FParse::Value(*Params, TEXT("Files="), FilesString))
+		{
+			TArray<FString> Files;
+			FilesString.ParseIntoArray(Files, TEXT(","));
+			for (const FString& File : Files)
+			{
+				// Transient library with the default settings
+				UHLSLMaterialFunctionLibrary* Library = NewObject<UHLSLMaterialFunctionLibrary>(GetTransientPackage(), NAME_None, RF_Transient);
+				Library->File.FilePath = FPaths::ConvertRelativePathToFull(FPlatformProcess::LaunchDir(), File);
+				Library->bUpdateOnFileChange = false;
+				Libraries.Add(Library);
+			}
+		}
+		else if (FParse::Value(*Params, TEXT("Libraries="), LibrariesString))
+		{
+			TArray<FString> LibraryPaths;
+			LibrariesString.ParseIntoArray(LibraryPaths, TEXT(","));
+			for (const FString& LibraryPath : LibraryPaths)
+			{
+				UHLSLMaterialFunctionLibrary* Library = LoadObject<UHLSLMaterialFunctionLibrary>(nullptr, *LibraryPath);
+				if (!Library)
+				{
+					UE_LOG(LogHLSLMaterial, Error, TEXT("Failed to load library %s"), *LibraryPath);
+					return 1;
+				}
+				Libraries.Add(Library);
+			}
+		}
+		else
+		{
+			IAssetRegistry& AssetRegistry = FModuleManager::LoadModuleChecked<FAssetRegistryModule>(TEXT("AssetRegistry")).Get();
+			AssetRegistry.SearchAllAssets(true);
+
+			TArray<FAssetData> AssetDatas;
+			AssetRegistry.GetAssetsByClass(UE_501_SWITCH(UHLSLMaterialFunctionLibrary::StaticClass()->GetFName(), UHLSLMaterialFunctionLibrary::StaticClass()->GetClassPathName()), AssetDatas);
+
+			for (const FAssetData& AssetData : AssetDatas)
+			{
+				if (UHLSLMaterialFunctionLibrary* Library = Cast<UHLSLMaterialFunctionLibrary>(AssetData.GetAsset()))
+				{
+					Libraries.Add(Library);
+				}
+			}
+		}
+	}
+
+	// Sort to keep the combined manifest stable
+	Libraries.Sort([](const UHLSLMaterialFunctionLibrary& A, const UHLSLMaterialFunctionLibrary& B)
+	{
+		return A.File.FilePath < B.File.FilePath;
+	});
+
+	const auto WriteManifest = [](const FString& Path, const TFunctionRef<bool(FWriter&)> WriteLibraries)
+	{
+		FString Manifest;
+		const TSharedRef<FWriter> Writer = TJsonWriterFactory<TCHAR, TPrettyJsonPrintPolicy<TCHAR>>::Create(&Manifest);
+		Writer->WriteObjectStart();
+		Writer->WriteValue(TEXT("version"), ManifestVersion);
+		Writer->WriteArrayStart(TEXT("libraries"));
+		const bool bSuccess = WriteLibraries(*Writer);
+		Writer->WriteArrayEnd();
+		Writer->WriteObjectEnd();
+		Writer->Close();
+
+		if (!FFileHelper::SaveStringToFile(Manifest, *Path))
+		{
+			UE_LOG(LogHLSLMaterial, Error, TEXT("Failed to write %s"), *Path);
+			return false;
+		}
+		UE_LOG(LogHLSLMaterial, Display, TEXT("Manifest written to %s"), *Path);
+
+		return bSuccess;
+	};
+
+	bool bSuccess = true;
+	if (!OutputPath.IsEmpty())
+	{
+		bSuccess = WriteManifest(OutputPath, [&](FWriter& Writer)
+		{
+			bool bAllValid = true;
+			for (UHLSLMaterialFunctionLibrary* Library : Libraries)
+			{
+				bAllValid &= WriteLibrary(*Library, Writer);
+			}
+			return bAllValid;
+		});
+	}
+	else
+	{
+		for (UHLSLMaterialFunctionLibrary* Library : Libraries)
+		{
+			bSuccess &= WriteManifest(Library->GetFilePath() + ".manifest.json", [&](FWriter& Writer)
+			{
+				return WriteLibrary(*Library, Writer);
+			});
+		}
+	}
+
+	return bSuccess ? 0 : 1;
+}
+
+bool UHLSLMaterialManifestCommandlet::WriteLibrary(UHLSLMaterialFunctionLibrary& Library, FWriter& Writer)
+{
+	// Errors are written to the manifest instead of being shown
+	FHLSLMaterialMessages::FCaptureScope CaptureScope;
+	FHLSLMaterialMessages::FLibraryScope LibraryScope(Library);
+
+	Writer.WriteObjectStart();
+	Writer.WriteValue(TEXT("file"), Library.File.FilePath);
+	Writer.WriteValue(TEXT("library"), Library.HasAnyFlags(RF_Transient) ? FString() : Library.GetPathName());
+
+	FString Text;
+	FHLSLMaterialFunctionLibraryEditor::FPreparedLibrary PreparedLibrary;
+	if (!FHLSLMaterialFunctionLibraryEditor::TryLoadFileToString(Text, Library.GetFilePath()))
+	{
+		FHLSLMaterialMessages::ShowError(TEXT("Failed to read %s"), *Library.GetFilePath());
+	}
+	else if (FHLSLMaterialFunctionLibraryEditor::Prepare(Library, Text, PreparedLibrary))
+	{
+		Writer.WriteValue(TEXT("hash"), FHLSLMaterialUtilities::HashString(PreparedLibrary.BaseHash));
+
+		Writer.WriteArrayStart(TEXT("includes"));
+		for (const FString& IncludeFilePath : PreparedLibrary.IncludeFilePaths)
+		{
+			Writer.WriteValue(IncludeFilePath);
+		}
+		Writer.WriteArrayEnd();
+
+		Writer.WriteObjectStart(TEXT("defines"));
+		for (const FCustomDefine& Define : PreparedLibrary.AdditionalDefines)
+		{
+			Writer.WriteValue(Define.DefineName, Define.DefineValue);
+		}
+		Writer.WriteObjectEnd();
+
+		Writer.WriteArrayStart(TEXT("functions"));
+		for (const FHLSLMaterialFunction& Function : PreparedLibrary.Functions)
+		{
+			WriteFunction(Library, Function, Writer);
+		}
+		Writer.WriteArrayEnd();
+	}
+
+	bool bHasErrors = false;
+	Writer.WriteArrayStart(TEXT("messages"));
+	for (const FHLSLMaterialMessages::FMessage& Message : CaptureScope.Messages)
+	{
+		Writer.WriteObjectStart();
+		Writer.WriteValue(TEXT("severity"), FString(Message.bIsError ? TEXT("error") : TEXT("warning")));
+		Writer.WriteValue(TEXT("line"), Message.Line);
+		Writer.WriteValue(TEXT("message"), Message.Text);
+		Writer.WriteObjectEnd();
+
+		if (Message.bIsError)
+		{
+			UE_LOG(LogHLSLMaterial, Error, TEXT("%s"), *Message.ToString());
+			bHasErrors = true;
+		}
+		else
+		{
+			UE_LOG(LogHLSLMaterial, Warning, TEXT("%s"), *Message.ToString());
+		}
+	}
+	Writer.WriteArrayEnd();
+
+	Writer.WriteObjectEnd();
+
+	return !bHasErrors;
+}
+
+void UHLSLMaterialManifestCommandlet::WriteFunction(const UHLSLMaterialFunctionLibrary& Library, const FHLSLMaterialFunction& Function, FWriter& Writer)
+{
+	using FGenerator = FHLSLMaterialFunctionGenerator;
+
+	TArray<FString> Arguments;
+	for (const FString& Argument : Function.Arguments)
+	{
+		Arguments.Add(Argument.TrimStartAndEnd());
+	}
+
+	Writer.WriteObjectStart();
+	Writer.WriteValue(TEXT("name"), Function.Name);
+	Writer.WriteValue(TEXT("line"), Function.DeclarationLine);
+	Writer.WriteValue(TEXT("signature"), Function.ReturnType + " " + Function.Name + "(" + FString::Join(Arguments, TEXT(", ")) + ")");
+	Writer.WriteValue(TEXT("hash"), Function.HashedString);
+
+	FGenerator::FAnalysis Analysis;
+	const FString Error = FGenerator::AnalyzeFunction(Library, Function, Analysis);
+	if (!Error.IsEmpty())
+	{
+		FHLSLMaterialMessages::ShowErrorAtLine(Function.DeclarationLine, TEXT("Function %s: %s"), *Function.Name, *Error);
+
+		Writer.WriteValue(TEXT("error"), Error);
+		Writer.WriteObjectEnd();
+		return;
+	}
+
+	Writer.WriteObjectStart(TEXT("metadata"));
+	WriteMetadata(Analysis.Signature.Metadata, Writer);
+	Writer.WriteObjectEnd();
+
+	Writer.WriteValue(TEXT("permutations"), Analysis.NumPermutations);
+	Writer.WriteValue(TEXT("textures"), Analysis.NumTextures);
+	Writer.WriteValue(TEXT("samplers"), Analysis.NumSamplers);
+
+	const auto WritePins = [&](const TCHAR* Identifier, const TArray<FGenerator::FPin>& Pins)
+	{
+		Writer.WriteArrayStart(Identifier);
+		for (const FGenerator::FPin& Pin : Pins)
+		{
+			Writer.WriteObjectStart();
+			Writer.WriteValue(TEXT("name"), Pin.DisplayName.IsEmpty() ? Pin.Name : Pin.DisplayName);
+			Writer.WriteValue(TEXT("type"), Pin.Type);
+			if (!Pin.DefaultValue.IsEmpty())
+			{
+				Writer.WriteValue(TEXT("default"), Pin.DefaultValue);
+			}
+			if (!Pin.ToolTip.IsEmpty())
+			{
+				Writer.WriteValue(TEXT("tooltip"), Pin.ToolTip);
+			}
+			Writer.WriteValue(TEXT("static"), Pin.FunctionInputType == FunctionInput_StaticBool);
+			// Generated from another argument, eg the rows of a matrix
+			Writer.WriteValue(TEXT("internal"), Pin.bIsInternal);
+			if (Pin.bIsOutput)
+			{
+				Writer.WriteValue(TEXT("interpolated"), Pin.IsInterpolated());
+			}
+
+			Writer.WriteObjectStart(TEXT("metadata"));
+			WriteMetadata(Pin.Metadata, Writer);
+			Writer.WriteObjectEnd();
+
+			Writer.WriteObjectEnd();
+		}
+		Writer.WriteArrayEnd();
+	};
+	WritePins(TEXT("inputs"), Analysis.Inputs);
+	WritePins(TEXT("outputs"), Analysis.Outputs);
+
+	// Interpolants & material features the Custom nodes depend on, eg TEXCOORD or VERTEX_COLOR
+	Writer.WriteArrayStart(TEXT("interpolants"));
+	for (const FGenerator::FDependency& Dependency : Analysis.Dependencies)
+	{
+		if (Dependency.Class == UMaterialExpressionTextureCoordinate::StaticClass())
+		{
+			// Index is the highest one used
+			Writer.WriteValue(FString::Printf(TEXT("%s%d"), *Dependency.Name, Dependency.Index));
+		}
+		else
+		{
+			Writer.WriteValue(Dependency.Name);
+		}
+	}
+	Writer.WriteArrayEnd();
+
+	Writer.WriteObjectEnd();
+}
+
+void UHLSLMaterialManifestCommandlet::WriteMetadata(const TMap<FString, FString>& Metadata, FWriter& Writer)
+{
+	// Sorted to keep the manifest stable
+	TArray<FString> Keys;
+	Metadata.GenerateKeyArray(Keys);
+	Keys.Sort();
+
+	for (const FString& Key : Keys)
+	{
+		Writer.WriteValue(Key, Metadata[Key]);
+	}
+}
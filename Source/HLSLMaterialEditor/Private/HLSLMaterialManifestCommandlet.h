@@ -0,0 +1,45 @@
+// Copyright Phyronnaz
+
+#pragma once
+
+#include "CoreMinimal.h"
+#include "Commandlets/Commandlet.h"
+#include "Serialization/JsonWriter.h"
+#include "Policies/PrettyJsonPrintPolicy.h"
+#include "HLSLMaterialManifestCommandlet.generated.h"
+
+class UHLSLMaterialFunctionLibrary;
+struct FHLSLMaterialFunction;
+
+// Writes a JSON manifest of the functions of HLSL libraries: signature, pins, defaults, metadata, hashes, permutation count
+// & interpolants used, along with the errors found as File.hlsl:Line. Nothing is generated, so it's cheap enough to run in CI
+// Still a commandlet: it pays for the editor startup, so batch the files rather than running it once per file
+//
+// UnrealEditor-Cmd MyProject -run=HLSLMaterialManifest -nullrhi [-Files=A.hlsl,B.hlsl] [-Libraries=/Game/A,/Game/B] [-Output=Path.json]
+//
+// -Files analyzes HLSL files with the default library settings, -Libraries with the settings of existing library assets.
+// By default all libraries are processed, and each manifest is written next to the library HLSL file as File.hlsl.manifest.json.
+// With -Output, a single manifest with all the libraries is written instead. Returns 1 if any library has errors
+UCLASS()
+class UHLSLMaterialManifestCommandlet : public UCommandlet
+{
+	GENERATED_BODY()
+
+public:
+	UHLSLMaterialManifestCommandlet();
+
+	//~ Begin UCommandlet Interface
+	virtual int32 Main(const FString& Params) override;
+	//~ End UCommandlet Interface
+
+	// Bump when the format changes
+	static constexpr int32 ManifestVersion = 1;
+
+private:
+	using FWriter = TJsonWriter<TCHAR, TPrettyJsonPrintPolicy<TCHAR>>;
+
+	// Returns false if the library has errors
+	static bool WriteLibrary(UHLSLMaterialFunctionLibrary& Library, FWriter& Writer);
+	static void WriteFunction(const UHLSLMaterialFunctionLibrary& Library, const FHLSLMaterialFunction& Function, FWriter& Writer);
+	static void WriteMetadata(const TMap<FString, FString>& Metadata, FWriter& Writer);
+};
@@ -6,19 +6,56 @@
 #include "Framework/Notifications/NotificationManager.h"
 #include "Widgets/Notifications/SNotificationList.h"
 
-void FHLSLMaterialMessages::ShowErrorImpl(FString Message)
+FString FHLSLMaterialMessages::FMessage::ToString() const
 {
+	if (FilePath.IsEmpty())
+	{
+		return Text;
+	}
+	if (Line <= 0)
+	{
+		return FilePath + ": " + Text;
+	}
+	return FString::Printf(TEXT("%s:%d: %s"), *FilePath, Line, *Text);
+}
+
+void FHLSLMaterialMessages::ShowImpl(const FString& Text, bool bIsError, int32 Line, bool bNotify)
+{
+	FMessage NewMessage;
+	NewMessage.Line = Line;
+	NewMessage.Text = Text;
+	NewMessage.bIsError = bIsError;
+
 	if (FLibraryScope::Library)
 	{
-		Message = FLibraryScope::Library->File.FilePath + ": " + Message;
+		NewMessage.FilePath = FLibraryScope::Library->File.FilePath;
+	}
+
+	if (FCaptureScope::Current)
+	{
+		FCaptureScope::Current->Messages.Add(NewMessage);
+		return;
 	}
 
-	FNotificationInfo Info(FText::FromString(Message));
-	Info.ExpireDuration = 10.f;
-	Info.CheckBoxState = ECheckBoxState::Unchecked;
-	FSlateNotificationManager::Get().AddNotification(Info);
+	const FString Message = NewMessage.ToString();
+
+	if (bNotify && !IsRunningCommandlet())
+	{
+		FNotificationInfo Info(FText::FromString(Message));
+		Info.ExpireDuration = 10.f;
+		Info.CheckBoxState = ECheckBoxState::Unchecked;
+		FSlateNotificationManager::Get().AddNotification(Info);
+	}
 
-	UE_LOG(LogHLSLMaterial, Error, TEXT("%s"), *Message);
+	if (bIsError)
+	{
+		UE_LOG(LogHLSLMaterial, Error, TEXT("%s"), *Message);
+	}
+	else
+	{
+		UE_LOG(LogHLSLMaterial, Warning, TEXT("%s"), *Message);
+	}
 }
 
-UHLSLMaterialFunctionLibrary* FHLSLMaterialMessages::FLibraryScope::Library;
\ No newline at end of file
+UHLSLMaterialFunctionLibrary* FHLSLMaterialMessages::FLibraryScope::Library;
+FHLSLMaterialMessages::FCaptureScope* FHLSLMaterialMessages::FCaptureScope::Current;
\ No newline at end of file
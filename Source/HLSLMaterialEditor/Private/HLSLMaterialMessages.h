@@ -12,9 +12,45 @@ public:
 	template <typename FmtType, typename... Types>
 	static void ShowError(const FmtType& Fmt, Types... Args)
 	{
-		ShowErrorImpl(FString::Printf(Fmt, Args...));
+		ShowImpl(FString::Printf(Fmt, Args...), true);
+	}
+	template <typename FmtType, typename... Types>
+	static void ShowWarning(const FmtType& Fmt, Types... Args)
+	{
+		ShowImpl(FString::Printf(Fmt, Args...), false);
 	}
 
+	// Line is 1-based, 0 if unknown
+	template <typename FmtType, typename... Types>
+	static void ShowErrorAtLine(int32 Line, const FmtType& Fmt, Types... Args)
+	{
+		ShowImpl(FString::Printf(Fmt, Args...), true, Line);
+	}
+	template <typename FmtType, typename... Types>
+	static void ShowWarningAtLine(int32 Line, const FmtType& Fmt, Types... Args)
+	{
+		ShowImpl(FString::Printf(Fmt, Args...), false, Line);
+	}
+
+	// Collected by capture scopes like any other warning, but otherwise only logged, without a notification
+	template <typename FmtType, typename... Types>
+	static void LogWarningAtLine(int32 Line, const FmtType& Fmt, Types... Args)
+	{
+		ShowImpl(FString::Printf(Fmt, Args...), false, Line, false);
+	}
+
+	struct FMessage
+	{
+		FString FilePath;
+		// 1-based, 0 if unknown
+		int32 Line = 0;
+		FString Text;
+		bool bIsError = false;
+
+		// eg MyFile.hlsl:12: Invalid arguments syntax, which IDEs & CI logs can link to the file
+		FString ToString() const;
+	};
+
 	class FLibraryScope
 	{
 	public:
@@ -30,6 +66,24 @@ public:
 		friend class FHLSLMaterialMessages;
 	};
 
+	// Collects the messages instead of showing them, eg to write them to a manifest
+	class FCaptureScope
+	{
+	public:
+		TArray<FMessage> Messages;
+
+		FCaptureScope()
+			: Guard(Current, this)
+		{
+		}
+
+	private:
+		static FCaptureScope* Current;
+		TGuardValue<FCaptureScope*> Guard;
+
+		friend class FHLSLMaterialMessages;
+	};
+
 private:
-	static void ShowErrorImpl(FString Message);
+	static void ShowImpl(const FString& Text, bool bIsError, int32 Line = 0, bool bNotify = true);
 };
\ No newline at end of file
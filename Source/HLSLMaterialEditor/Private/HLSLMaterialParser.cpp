@@ -9,9 +9,10 @@
 
 FString FHLSLMaterialParser::Parse(
 	const UHLSLMaterialFunctionLibrary& Library, 
-	FString Text, 
+	const FString& Text, 
 	TArray<FHLSLMaterialFunction>& OutFunctions,
-	TArray<FString>& OutStructs)
+	TArray<FString>& OutStructs,
+	int32& OutErrorLine)
 {
 	enum class EScope
 	{
@@ -33,20 +34,29 @@ FString FHLSLMaterialParser::Parse(
 	int32 ArgParenthesisScopeDepth = 0;
 	int32 ArgBracketScopeDepth = 0;
 	int32 LineNumber = 0;
+	// Line of the function or struct being parsed, to report unterminated ones
+	int32 ScopeStartLine = 0;
 
-	// Simplify line breaks handling
-	Text.ReplaceInline(TEXT("\r\n"), TEXT("\n"));
+	// Whether the whitespace-delimited token at Start is Word
+	const auto IsToken = [&](int32 Start, const TCHAR* Word)
+	{
+		const int32 WordLen = FCString::Strlen(Word);
+		return
+			Start + WordLen <= Text.Len() &&
+			FCString::Strncmp(&Text[Start], Word, WordLen) == 0 &&
+			(Start + WordLen == Text.Len() || FChar::IsWhitespace(Text[Start + WordLen]));
+	};
 
 	while (Index < Text.Len())
 	{
-		FString Token;
-		for (int32 TokenIndex = Index; TokenIndex < Text.Len() && !FChar::IsWhitespace(Text[TokenIndex]); TokenIndex++)
+		const TCHAR Char = Text[Index++];
+
+		if (Char == TEXT('\r') && Index < Text.Len() && Text[Index] == TEXT('\n'))
 		{
-			Token += Text[TokenIndex];
+			// Handle \r\n as a single \n, so that spans never contain \r\n
+			continue;
 		}
-		
-		const TCHAR Char = Text[Index++];
-		
+
 		if (FChar::IsLinebreak(Char))
 		{
 			LineNumber++;
@@ -79,6 +89,7 @@ FString FHLSLMaterialParser::Parse(
 				OutFunctions.Emplace();
 			}
 			Index--;
+			ScopeStartLine = LineNumber;
 
 			if (Char == TEXT('#'))
 			{
@@ -92,7 +103,7 @@ FString FHLSLMaterialParser::Parse(
 			{
 				Scope = EScope::FunctionMetadata;
 			}
-			else if (Token == TEXT("struct"))
+			else if (IsToken(Index, TEXT("struct")))
 			{
 				Scope = EScope::Struct;
 				OutStructs.Emplace();
@@ -100,6 +111,7 @@ FString FHLSLMaterialParser::Parse(
 			else
 			{
 				Scope = EScope::FunctionReturn;
+				OutFunctions.Last().DeclarationLine = LineNumber + 1;
 			}
 		}
 		break;
@@ -223,6 +235,7 @@ FString FHLSLMaterialParser::Parse(
 
 			if (Char != TEXT('{'))
 			{
+				OutErrorLine = LineNumber + 1;
 				return FString::Printf(TEXT("Invalid function body for %s: missing {"), *OutFunctions.Last().Name);
 			}
 
@@ -255,6 +268,7 @@ FString FHLSLMaterialParser::Parse(
 			}
 			if (ScopeDepth < 0)
 			{
+				OutErrorLine = LineNumber + 1;
 				return FString::Printf(TEXT("Invalid function body for %s: too many }"), *OutFunctions.Last().Name);
 			}
 
@@ -298,7 +312,8 @@ FString FHLSLMaterialParser::Parse(
 
 	if (Scope != EScope::Global)
 	{
-		return TEXT("Parsing error");
+		OutErrorLine = ScopeStartLine + 1;
+		return TEXT("Parsing error: unexpected end of file");
 	}
 	ensure(ScopeDepth == 0);
 	ensure(ArgParenthesisScopeDepth == 0);
@@ -316,10 +331,22 @@ TArray<FHLSLMaterialParser::FInclude> FHLSLMaterialParser::GetIncludes(const FSt
 
 	TArray<FInclude> OutIncludes;
 
+	// Lines are counted incrementally, matches are in order
+	int32 Line = 1;
+	int32 LineIndex = 0;
+
 	FRegexPattern RegexPattern(R"_((\A|\v)\s*#include "([^"]+)")_");
 	FRegexMatcher RegexMatcher(RegexPattern, Text);
 	while (RegexMatcher.FindNext())
 	{
+		for (const int32 End = RegexMatcher.GetCaptureGroupBeginning(2); LineIndex < End; LineIndex++)
+		{
+			if (Text[LineIndex] == TEXT('\n'))
+			{
+				Line++;
+			}
+		}
+
 		FString VirtualPath = RegexMatcher.GetCaptureGroup(2);
 		if (!VirtualPath.StartsWith(TEXT("/")) && !VirtualFolder.IsEmpty())
 		{
@@ -330,14 +357,14 @@ TArray<FHLSLMaterialParser::FInclude> FHLSLMaterialParser::GetIncludes(const FSt
 		FString DiskPath = GetShaderSourceFilePath(VirtualPath);
 		if (DiskPath.IsEmpty())
 		{
-			FHLSLMaterialMessages::ShowError(TEXT("Failed to map include %s"), *VirtualPath);
+			FHLSLMaterialMessages::ShowErrorAtLine(Line, TEXT("Failed to map include %s"), *VirtualPath);
 		}
 		else
 		{
 			DiskPath = FPaths::ConvertRelativePathToFull(DiskPath);
 		}
 
-		OutIncludes.Add({ VirtualPath, DiskPath });
+		OutIncludes.Add({ VirtualPath, DiskPath, Line });
 	}
 
 	return OutIncludes;
@@ -355,4 +382,531 @@ TArray<FCustomDefine> FHLSLMaterialParser::GetDefines(const FString& Text)
 	}
 
 	return OutDefines;
-}
\ No newline at end of file
+}
+
+///////////////////////////////////////////////////////////////////////////////
+///////////////////////////////////////////////////////////////////////////////
+///////////////////////////////////////////////////////////////////////////////
+
+struct FHLSLMaterialParserCursor
+{
+	const FString& Text;
+	int32 Index = 0;
+
+	explicit FHLSLMaterialParserCursor(const FString& Text)
+		: Text(Text)
+	{
+	}
+
+	bool IsDone() const
+	{
+		return Index >= Text.Len();
+	}
+	TCHAR Peek() const
+	{
+		return IsDone() ? TEXT('\0') : Text[Index];
+	}
+	bool TryConsume(TCHAR Char)
+	{
+		if (IsDone() || Text[Index] != Char)
+		{
+			return false;
+		}
+		Index++;
+		return true;
+	}
+	// Returns true if any whitespace was skipped
+	bool SkipWhitespace()
+	{
+		const int32 StartIndex = Index;
+		while (!IsDone() && FChar::IsWhitespace(Text[Index]))
+		{
+			Index++;
+		}
+		return Index != StartIndex;
+	}
+	FString ParseIdentifier()
+	{
+		const int32 StartIndex = Index;
+		while (!IsDone() && (FChar::IsAlnum(Text[Index]) || Text[Index] == TEXT('_')))
+		{
+			Index++;
+		}
+		return Text.Mid(StartIndex, Index - StartIndex);
+	}
+	bool ParseFloat(float& OutValue)
+	{
+		FString Number;
+
+		SkipWhitespace();
+		if (TryConsume(TEXT('-')))
+		{
+			Number += TEXT('-');
+		}
+		SkipWhitespace();
+		TryConsume(TEXT('+'));
+		SkipWhitespace();
+
+		bool bHasDigits = false;
+		while (FChar::IsDigit(Peek()))
+		{
+			Number += Text[Index++];
+			bHasDigits = true;
+		}
+		if (TryConsume(TEXT('.')))
+		{
+			Number += TEXT('.');
+			while (FChar::IsDigit(Peek()))
+			{
+				Number += Text[Index++];
+				bHasDigits = true;
+			}
+		}
+		if (!bHasDigits)
+		{
+			return false;
+		}
+
+		TryConsume(TEXT('f'));
+		SkipWhitespace();
+
+		OutValue = FCString::Atof(*Number);
+		return true;
+	}
+};
+
+FString FHLSLMaterialParser::ParseSignature(const FHLSLMaterialFunction& Function, FHLSLMaterialSignature& OutSignature)
+{
+	if (!Function.Metadata.IsEmpty())
+	{
+		TArray<FString> Metadatas;
+		Function.Metadata.ParseIntoArray(Metadatas, TEXT("\n"));
+		for (FString Metadata : Metadatas)
+		{
+			Metadata.TrimStartAndEndInline();
+			if (!Metadata.RemoveFromStart("[") ||
+				!Metadata.RemoveFromEnd("]"))
+			{
+				return "Invalid function metadata: " + Metadata;
+			}
+
+			ParseMetadata(Metadata, OutSignature.Metadata);
+		}
+	}
+
+	for (const FString& Argument : Function.Arguments)
+	{
+		if (Function.Arguments.Num() == 1 && Argument.TrimStartAndEnd().IsEmpty())
+		{
+			// void Function( )
+			break;
+		}
+
+		if (!ParseArgument(Argument, OutSignature.Arguments.Emplace_GetRef()))
+		{
+			return "Invalid arguments syntax: " + Argument.TrimStartAndEnd();
+		}
+	}
+
+	OutSignature.ParamDocs = ParseParamDocs(Function.Comment);
+
+	return {};
+}
+
+bool FHLSLMaterialParser::ParseArgument(const FString& Argument, FHLSLMaterialArgument& OutArgument)
+{
+	// [Metadata] const|out Type<TemplateArgument> Name = DefaultValue
+
+	FHLSLMaterialParserCursor Cursor(Argument);
+	Cursor.SkipWhitespace();
+
+	if (Cursor.TryConsume(TEXT('[')))
+	{
+		const int32 StartIndex = Cursor.Index;
+
+		// Quoted metadata values can contain ]
+		bool bInString = false;
+		while (!Cursor.IsDone() && (bInString || Cursor.Peek() != TEXT(']')))
+		{
+			if (Cursor.Peek() == TEXT('"'))
+			{
+				bInString = !bInString;
+			}
+			Cursor.Index++;
+		}
+		if (Cursor.IsDone())
+		{
+			return false;
+		}
+
+		ParseMetadata(Argument.Mid(StartIndex, Cursor.Index - StartIndex), OutArgument.Metadata);
+
+		Cursor.Index++;
+		Cursor.SkipWhitespace();
+	}
+
+	FString Word = Cursor.ParseIdentifier();
+	if (Word == TEXT("const") || Word == TEXT("out"))
+	{
+		if (!Cursor.SkipWhitespace())
+		{
+			return false;
+		}
+
+		OutArgument.bIsConst = Word == TEXT("const");
+		OutArgument.bIsOutput = Word == TEXT("out");
+
+		Word = Cursor.ParseIdentifier();
+	}
+	if (Word.IsEmpty())
+	{
+		return false;
+	}
+	OutArgument.Type = Word;
+
+	Cursor.SkipWhitespace();
+	if (Cursor.TryConsume(TEXT('<')))
+	{
+		Cursor.SkipWhitespace();
+		OutArgument.TemplateArgument = Cursor.ParseIdentifier();
+		Cursor.SkipWhitespace();
+
+		if (OutArgument.TemplateArgument.IsEmpty() ||
+			!Cursor.TryConsume(TEXT('>')))
+		{
+			return false;
+		}
+		Cursor.SkipWhitespace();
+	}
+
+	OutArgument.Name = Cursor.ParseIdentifier();
+	if (OutArgument.Name.IsEmpty())
+	{
+		return false;
+	}
+
+	Cursor.SkipWhitespace();
+	if (Cursor.TryConsume(TEXT('=')))
+	{
+		OutArgument.DefaultValue = Argument.Mid(Cursor.Index).TrimStartAndEnd();
+		return !OutArgument.DefaultValue.IsEmpty();
+	}
+
+	return Cursor.IsDone();
+}
+
+void FHLSLMaterialParser::ParseMetadata(const FString& Metadata, TMap<FString, FString>& OutMetadata)
+{
+	// Key, Key = Value, Key = "Value", Key(Value)
+
+	FHLSLMaterialParserCursor Cursor(Metadata);
+	while (!Cursor.IsDone())
+	{
+		Cursor.SkipWhitespace();
+		const FString Key = Cursor.ParseIdentifier();
+		Cursor.SkipWhitespace();
+
+		FString Value;
+		if (!Key.IsEmpty() && Cursor.TryConsume(TEXT('=')))
+		{
+			Cursor.SkipWhitespace();
+			if (Cursor.TryConsume(TEXT('"')))
+			{
+				const int32 StartIndex = Cursor.Index;
+				while (!Cursor.IsDone() && Cursor.Peek() != TEXT('"'))
+				{
+					Cursor.Index++;
+				}
+				Value = Metadata.Mid(StartIndex, Cursor.Index - StartIndex);
+				Cursor.TryConsume(TEXT('"'));
+			}
+			else
+			{
+				Value = Cursor.ParseIdentifier();
+			}
+			Cursor.SkipWhitespace();
+		}
+		else if (!Key.IsEmpty() && Cursor.TryConsume(TEXT('(')))
+		{
+			// Can contain commas, eg Values(A, B, C)
+			const int32 StartIndex = Cursor.Index;
+			while (!Cursor.IsDone() && Cursor.Peek() != TEXT(')'))
+			{
+				Cursor.Index++;
+			}
+			Value = Metadata.Mid(StartIndex, Cursor.Index - StartIndex).TrimStartAndEnd();
+			Cursor.TryConsume(TEXT(')'));
+			Cursor.SkipWhitespace();
+		}
+
+		if (!Key.IsEmpty() &&
+			(Cursor.IsDone() || Cursor.Peek() == TEXT(',')))
+		{
+			OutMetadata.Add(Key, Value);
+		}
+
+		// Skip to the next entry, ignoring anything invalid
+		while (!Cursor.IsDone() && !Cursor.TryConsume(TEXT(',')))
+		{
+			Cursor.Index++;
+		}
+	}
+}
+
+TMap<FString, FString> FHLSLMaterialParser::ParseParamDocs(const FString& Comment)
+{
+	TMap<FString, FString> ParamDocs;
+
+	int32 Index = 0;
+	while (Index < Comment.Len())
+	{
+		Index = Comment.Find(TEXT("@param"), ESearchCase::IgnoreCase, ESearchDir::FromStart, Index);
+		if (Index == INDEX_NONE)
+		{
+			break;
+		}
+
+		Index += FCString::Strlen(TEXT("@param"));
+
+		while (Index < Comment.Len() && FChar::IsWhitespace(Comment[Index]))
+		{
+			Index++;
+		}
+
+		const int32 NameStartIndex = Index;
+		while (Index < Comment.Len() && !FChar::IsWhitespace(Comment[Index]))
+		{
+			Index++;
+		}
+		const FString ParamName = Comment.Mid(NameStartIndex, Index - NameStartIndex);
+
+		while (Index < Comment.Len() && FChar::IsWhitespace(Comment[Index]) && !FChar::IsLinebreak(Comment[Index]))
+		{
+			Index++;
+		}
+
+		const int32 DocStartIndex = Index;
+		while (Index < Comment.Len() && !FChar::IsLinebreak(Comment[Index]))
+		{
+			Index++;
+		}
+
+		if (!ParamDocs.Contains(ParamName))
+		{
+			ParamDocs.Add(ParamName, Comment.Mid(DocStartIndex, Index - DocStartIndex).TrimStartAndEnd());
+		}
+	}
+
+	return ParamDocs;
+}
+
+bool FHLSLMaterialParser::ParseDefaultValue(const FString& DefaultValue, const FString& Type, int32 Dimension, FVector4& OutValue)
+{
+	check(1 <= Dimension && Dimension <= 4);
+
+	{
+		FHLSLMaterialParserCursor Cursor(DefaultValue);
+
+		float SingleValue;
+		if (Cursor.ParseFloat(SingleValue) && Cursor.IsDone())
+		{
+			if (Dimension == 1)
+			{
+				OutValue.X = SingleValue;
+			}
+			else
+			{
+				OutValue = FVector4(SingleValue);
+			}
+			return true;
+		}
+	}
+
+	FHLSLMaterialParserCursor Cursor(DefaultValue);
+	Cursor.SkipWhitespace();
+
+	if (Cursor.ParseIdentifier() != Type)
+	{
+		return false;
+	}
+
+	Cursor.SkipWhitespace();
+	if (!Cursor.TryConsume(TEXT('(')))
+	{
+		return false;
+	}
+
+	FVector4 Value{ ForceInit };
+	for (int32 Index = 0; Index < Dimension; Index++)
+	{
+		float ComponentValue;
+		if (!Cursor.ParseFloat(ComponentValue))
+		{
+			return false;
+		}
+		Value[Index] = ComponentValue;
+
+		if (Index != Dimension - 1 &&
+			!Cursor.TryConsume(TEXT(',')))
+		{
+			return false;
+		}
+	}
+
+	if (!Cursor.TryConsume(TEXT(')')))
+	{
+		return false;
+	}
+
+	Cursor.SkipWhitespace();
+	if (!Cursor.IsDone())
+	{
+		return false;
+	}
+
+	OutValue = Value;
+	return true;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+///////////////////////////////////////////////////////////////////////////////
+///////////////////////////////////////////////////////////////////////////////
+
+FString FHLSLMaterialParser::CanonicalizeCode(const FString& Code)
+{
+	// Whitespace can only be removed next to these without changing the tokens, eg a - -b != a--b
+	const auto IsSeparator = [](TCHAR Char)
+	{
+		return
+			Char == TEXT('(') ||
+			Char == TEXT(')') ||
+			Char == TEXT('{') ||
+			Char == TEXT('}') ||
+			Char == TEXT('[') ||
+			Char == TEXT(']') ||
+			Char == TEXT(';') ||
+			Char == TEXT(',') ||
+			FChar::IsLinebreak(Char);
+	};
+
+	FString Result;
+	Result.Reserve(Code.Len());
+
+	bool bPendingSpace = false;
+	bool bLineStart = true;
+	bool bInDirective = false;
+
+	const auto Append = [&](TCHAR Char)
+	{
+		if (bPendingSpace &&
+			Result.Len() > 0 &&
+			!IsSeparator(Result[Result.Len() - 1]) &&
+			!IsSeparator(Char))
+		{
+			Result += TEXT(' ');
+		}
+		bPendingSpace = false;
+		Result += Char;
+	};
+
+	int32 Index = 0;
+	while (Index < Code.Len())
+	{
+		const TCHAR Char = Code[Index];
+		const TCHAR NextChar = Index + 1 < Code.Len() ? Code[Index + 1] : TEXT('\0');
+
+		if (Char == TEXT('/') && NextChar == TEXT('/'))
+		{
+			// The line break is handled below
+			while (Index < Code.Len() && !FChar::IsLinebreak(Code[Index]))
+			{
+				Index++;
+			}
+			continue;
+		}
+		if (Char == TEXT('/') && NextChar == TEXT('*'))
+		{
+			Index += 2;
+			while (Index < Code.Len() && !(Code[Index] == TEXT('*') && Index + 1 < Code.Len() && Code[Index + 1] == TEXT('/')))
+			{
+				Index++;
+			}
+			Index += 2;
+			bPendingSpace = true;
+			continue;
+		}
+		if (bInDirective && Char == TEXT('\\') && FChar::IsLinebreak(NextChar))
+		{
+			// Line continuation: join the lines
+			Index += 2;
+			bPendingSpace = true;
+			continue;
+		}
+		if (FChar::IsLinebreak(Char))
+		{
+			Index++;
+			bLineStart = true;
+
+			if (bInDirective)
+			{
+				// Preprocessor directives must stay on their own line
+				Result += TEXT('\n');
+				bInDirective = false;
+				bPendingSpace = false;
+			}
+			else
+			{
+				bPendingSpace = true;
+			}
+			continue;
+		}
+		if (FChar::IsWhitespace(Char))
+		{
+			Index++;
+			bPendingSpace = true;
+			continue;
+		}
+
+		if (Char == TEXT('#') && bLineStart)
+		{
+			if (Result.Len() > 0 && !FChar::IsLinebreak(Result[Result.Len() - 1]))
+			{
+				Result += TEXT('\n');
+			}
+			bPendingSpace = false;
+			bInDirective = true;
+		}
+		bLineStart = false;
+
+		if (Char == TEXT('"'))
+		{
+			// Keep string literals untouched
+			Append(Char);
+			Index++;
+
+			while (Index < Code.Len() && Code[Index] != TEXT('"') && !FChar::IsLinebreak(Code[Index]))
+			{
+				if (Code[Index] == TEXT('\\') && Index + 1 < Code.Len())
+				{
+					Result += Code[Index++];
+				}
+				Result += Code[Index++];
+			}
+			if (Index < Code.Len() && Code[Index] == TEXT('"'))
+			{
+				Result += Code[Index++];
+			}
+			continue;
+		}
+
+		Append(Char);
+		Index++;
+	}
+
+	if (bInDirective)
+	{
+		Result += TEXT('\n');
+	}
+
+	return Result;
+}
@@ -6,6 +6,8 @@
 
 struct FCustomDefine;
 struct FHLSLMaterialFunction;
+struct FHLSLMaterialArgument;
+struct FHLSLMaterialSignature;
 class UHLSLMaterialFunctionLibrary;
 
 class FHLSLMaterialParser
@@ -13,15 +15,29 @@ class FHLSLMaterialParser
 public:
 	static FString Parse(
 		const UHLSLMaterialFunctionLibrary& Library, 
-		FString Text, 
+		const FString& Text, 
 		TArray<FHLSLMaterialFunction>& OutFunctions,
-		TArray<FString>& OutStructs);
+		TArray<FString>& OutStructs,
+		int32& OutErrorLine);
 
 	struct FInclude
 	{
 		FString VirtualPath;
 		FString DiskPath;
+		// 1-based line of the #include
+		int32 Line = 0;
 	};
 	static TArray<FInclude> GetIncludes(const FString& FilePath, const FString& Text);
 	static TArray<FCustomDefine> GetDefines(const FString& Text);
+
+	static FString ParseSignature(const FHLSLMaterialFunction& Function, FHLSLMaterialSignature& OutSignature);
+	static bool ParseArgument(const FString& Argument, FHLSLMaterialArgument& OutArgument);
+	// eg Expose, Category="My Category", Values(A, B)
+	static void ParseMetadata(const FString& Metadata, TMap<FString, FString>& OutMetadata);
+	static TMap<FString, FString> ParseParamDocs(const FString& Comment);
+	// Either a single float, or a Type(X, Y...) constructor with Dimension components
+	static bool ParseDefaultValue(const FString& DefaultValue, const FString& Type, int32 Dimension, FVector4& OutValue);
+
+	// Strip comments & normalize whitespace, so that functionally identical code gives the same string
+	static FString CanonicalizeCode(const FString& Code);
 };
\ No newline at end of file
@@ -0,0 +1,147 @@
+// Copyright Phyronnaz
+
+#include "HLSLMaterialPreviewCompilation.h"
+#include "HLSLMaterialSettings.h"
+#include "HLSLMaterialUtilities.h"
+#include "HLSLMaterialFunctionLibrary.h"
+
+#include "Editor.h"
+#include "MaterialShared.h"
+#include "Containers/Ticker.h"
+#include "Materials/Material.h"
+#include "Materials/MaterialFunction.h"
+#include "UObject/UObjectGlobals.h"
+
+TSet<TWeakObjectPtr<UMaterial>> FHLSLMaterialPreviewCompilation::PendingMaterials;
+TSet<TWeakObjectPtr<UMaterial>> FHLSLMaterialPreviewCompilation::MaterialsToCompile;
+
+void FHLSLMaterialPreviewCompilation::Register()
+{
+	if (IsRunningCommandlet())
+	{
+		return;
+	}
+
+#if ENGINE_VERSION < 500
+	FCoreUObjectDelegates::OnObjectSaved.AddStatic(&OnObjectSaved);
+#else
+	FCoreUObjectDelegates::OnObjectPreSave.AddLambda([](UObject* Object, FObjectPreSaveContext Context)
+	{
+		if (!Context.IsCooking())
+		{
+			OnObjectSaved(Object);
+		}
+	});
+#endif
+
+	UE_500_SWITCH(FTicker, FTSTicker)::GetCoreTicker().AddTicker(FTickerDelegate::CreateStatic(&Tick));
+}
+HLSL_STARTUP_FUNCTION(EDelayedRegisterRunPhase::EndOfEngineInit, FHLSLMaterialPreviewCompilation::Register);
+
+///////////////////////////////////////////////////////////////////////////////
+///////////////////////////////////////////////////////////////////////////////
+///////////////////////////////////////////////////////////////////////////////
+
+FHLSLMaterialPreviewCompilation::FScope::FScope()
+{
+	if (!GetDefault<UHLSLMaterialSettings>()->bCompilePreviewPlatformOnly ||
+		!GEditor ||
+		!GEditor->GetEditorWorldContext().World())
+	{
+		return;
+	}
+
+	const ERHIFeatureLevel::Type PreviewFeatureLevel = GEditor->GetEditorWorldContext().World()->FeatureLevel;
+	const uint32 FeatureLevels = UMaterialInterface::GetFeatureLevelsToCompileForAllMaterials();
+
+	for (int32 Index = 0; Index < ERHIFeatureLevel::Num; Index++)
+	{
+		const ERHIFeatureLevel::Type FeatureLevel = ERHIFeatureLevel::Type(Index);
+		if (!(FeatureLevels & (1 << Index)) ||
+			FeatureLevel == PreviewFeatureLevel ||
+			FeatureLevel == GMaxRHIFeatureLevel)
+		{
+			continue;
+		}
+
+		UMaterialInterface::SetGlobalRequiredFeatureLevel(FeatureLevel, false);
+		RestoredFeatureLevels |= 1 << Index;
+	}
+}
+
+FHLSLMaterialPreviewCompilation::FScope::~FScope()
+{
+	for (int32 Index = 0; Index < ERHIFeatureLevel::Num; Index++)
+	{
+		if (RestoredFeatureLevels & (1 << Index))
+		{
+			UMaterialInterface::SetGlobalRequiredFeatureLevel(ERHIFeatureLevel::Type(Index), true);
+		}
+	}
+}
+
+///////////////////////////////////////////////////////////////////////////////
+///////////////////////////////////////////////////////////////////////////////
+///////////////////////////////////////////////////////////////////////////////
+
+void FHLSLMaterialPreviewCompilation::AddPendingMaterial(UMaterial& Material)
+{
+	PendingMaterials.Add(&Material);
+}
+
+void FHLSLMaterialPreviewCompilation::OnObjectSaved(UObject* Object)
+{
+	if (PendingMaterials.Num() == 0)
+	{
+		return;
+	}
+
+	// Compiled on the next tick rather than while saving
+	if (Object->IsA<UHLSLMaterialFunctionLibrary>() ||
+		Object->IsA<UMaterialFunction>())
+	{
+		MaterialsToCompile.Append(PendingMaterials);
+	}
+	else if (UMaterial* Material = Cast<UMaterial>(Object))
+	{
+		if (PendingMaterials.Contains(Material))
+		{
+			MaterialsToCompile.Add(Material);
+		}
+	}
+}
+
+bool FHLSLMaterialPreviewCompilation::Tick(float DeltaTime)
+{
+	if (PendingMaterials.Num() > 0 &&
+		!GetDefault<UHLSLMaterialSettings>()->bCompilePreviewPlatformOnly)
+	{
+		// Setting was turned off
+		MaterialsToCompile.Append(PendingMaterials);
+	}
+
+	if (MaterialsToCompile.Num() == 0)
+	{
+		return true;
+	}
+
+	FMaterialUpdateContext UpdateContext;
+
+	int32 NumCompiled = 0;
+	for (const TWeakObjectPtr<UMaterial>& WeakMaterial : MaterialsToCompile)
+	{
+		PendingMaterials.Remove(WeakMaterial);
+
+		if (UMaterial* Material = WeakMaterial.Get())
+		{
+			UpdateContext.AddMaterial(Material);
+			Material->ForceRecompileForRendering();
+			NumCompiled++;
+		}
+	}
+	MaterialsToCompile.Reset();
+
+	UE_LOG(LogHLSLMaterial, Log, TEXT("Compiling %d materials for all feature levels"), NumCompiled);
+
+	return true;
+}
@@ -0,0 +1,45 @@
+// Copyright Phyronnaz
+
+#pragma once
+
+#include "CoreMinimal.h"
+#include "UObject/WeakObjectPtrTemplates.h"
+
+class UObject;
+class UMaterial;
+
+// With bCompilePreviewPlatformOnly, materials refreshed after a regeneration are only compiled for the editor preview feature level.
+// They are compiled for all the feature levels once they or a library are saved, or when the setting is turned off
+class FHLSLMaterialPreviewCompilation
+{
+public:
+	static void Register();
+
+	// Materials compiled within this scope skip the feature levels other than the preview one.
+	// The editor RHI feature level is always compiled by the engine
+	class FScope
+	{
+	public:
+		FScope();
+		~FScope();
+
+		// False if the setting is off or if there's nothing to skip
+		bool IsRestricted() const
+		{
+			return RestoredFeatureLevels != 0;
+		}
+
+	private:
+		uint32 RestoredFeatureLevels = 0;
+	};
+
+	// Material compiled within a restricted scope, to compile fully later
+	static void AddPendingMaterial(UMaterial& Material);
+
+private:
+	static TSet<TWeakObjectPtr<UMaterial>> PendingMaterials;
+	static TSet<TWeakObjectPtr<UMaterial>> MaterialsToCompile;
+
+	static void OnObjectSaved(UObject* Object);
+	static bool Tick(float DeltaTime);
+};
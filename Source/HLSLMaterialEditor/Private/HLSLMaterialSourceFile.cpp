@@ -0,0 +1,153 @@
+// Copyright Phyronnaz
+
+#include "HLSLMaterialSourceFile.h"
+#include "HLSLMaterialUtilities.h"
+#include "Misc/FileHelper.h"
+#include "Async/MappedFileHandle.h"
+#include "HAL/PlatformFilemanager.h"
+
+FHLSLMaterialSourceFile::~FHLSLMaterialSourceFile()
+{
+	// Region must be released before the handle
+	MappedRegion.Reset();
+	MappedHandle.Reset();
+}
+
+TUniquePtr<FHLSLMaterialSourceFile> FHLSLMaterialSourceFile::Open(const FString& Path)
+{
+	if (!FPaths::FileExists(Path))
+	{
+		return nullptr;
+	}
+
+	TUniquePtr<FHLSLMaterialSourceFile> File = TryOpen(Path);
+	if (!File)
+	{
+		// Wait and retry in case the text editor has locked the file
+		FPlatformProcess::Sleep(0.1f);
+
+		File = TryOpen(Path);
+		if (!File)
+		{
+			UE_LOG(LogHLSLMaterial, Error, TEXT("Failed to read %s"), *Path);
+		}
+	}
+
+	return File;
+}
+
+FString FHLSLMaterialSourceFile::ToString() const
+{
+	if (IsUTF16())
+	{
+		// UTF-16, rare enough to go through the generic path
+		FString Result;
+		FFileHelper::BufferToString(Result, Data, Size);
+		Result.ReplaceInline(TEXT("\r\n"), TEXT("\n"));
+		return Result;
+	}
+
+	const uint8* Start = Data;
+	int64 Length = Size;
+	if (Length >= 3 && Start[0] == 0xEF && Start[1] == 0xBB && Start[2] == 0xBF)
+	{
+		// UTF-8 BOM
+		Start += 3;
+		Length -= 3;
+	}
+
+	if (Length == 0 || !ensure(Length <= MAX_int32))
+	{
+		return {};
+	}
+
+	// Decode straight into the string storage, then drop the \r of \r\n in place
+	FString Result;
+	TArray<TCHAR>& ResultChars = Result.GetCharArray();
+
+#if ENGINE_VERSION < 500
+	const ANSICHAR* Source = reinterpret_cast<const ANSICHAR*>(Start);
+	const int32 NumChars = FUTF8ToTCHAR_Convert::ConvertedLength(Source, int32(Length));
+	ResultChars.SetNumUninitialized(NumChars + 1);
+	FUTF8ToTCHAR_Convert::Convert(ResultChars.GetData(), NumChars, Source, int32(Length));
+#else
+	const UTF8CHAR* Source = reinterpret_cast<const UTF8CHAR*>(Start);
+	const int32 NumChars = FPlatformString::ConvertedLength<TCHAR>(Source, int32(Length));
+	ResultChars.SetNumUninitialized(NumChars + 1);
+	FPlatformString::Convert(ResultChars.GetData(), NumChars, Source, int32(Length));
+#endif
+
+	TCHAR* Chars = ResultChars.GetData();
+	int32 NumResultChars = 0;
+	for (int32 Index = 0; Index < NumChars; Index++)
+	{
+		if (Chars[Index] == TEXT('\r') && Index + 1 < NumChars && Chars[Index + 1] == TEXT('\n'))
+		{
+			continue;
+		}
+		Chars[NumResultChars++] = Chars[Index];
+	}
+	ResultChars[NumResultChars++] = TEXT('\0');
+	ResultChars.SetNum(NumResultChars, false);
+
+	return Result;
+}
+
+FGuid FHLSLMaterialSourceFile::Hash() const
+{
+	if (IsUTF16())
+	{
+		return FHLSLMaterialUtilities::HashStringToGuid(ToString());
+	}
+
+	const uint8* Start = Data;
+	int64 Length = Size;
+	if (Length >= 3 && Start[0] == 0xEF && Start[1] == 0xBB && Start[2] == 0xBF)
+	{
+		Start += 3;
+		Length -= 3;
+	}
+
+	return FHLSLMaterialUtilities::HashUTF8ToGuid(reinterpret_cast<const ANSICHAR*>(Start), Length);
+}
+
+bool FHLSLMaterialSourceFile::IsUTF16() const
+{
+	return
+		Size >= 2 &&
+		((Data[0] == 0xFF && Data[1] == 0xFE) ||
+		 (Data[0] == 0xFE && Data[1] == 0xFF));
+}
+
+TUniquePtr<FHLSLMaterialSourceFile> FHLSLMaterialSourceFile::TryOpen(const FString& Path)
+{
+	TUniquePtr<FHLSLMaterialSourceFile> File(new FHLSLMaterialSourceFile());
+
+	// Empty files can't be mapped
+	if (IFileManager::Get().FileSize(*Path) > 0)
+	{
+		File->MappedHandle = TUniquePtr<IMappedFileHandle>(FPlatformFileManager::Get().GetPlatformFile().OpenMapped(*Path));
+		if (File->MappedHandle)
+		{
+			File->MappedRegion = TUniquePtr<IMappedFileRegion>(File->MappedHandle->MapRegion());
+		}
+	}
+
+	if (File->MappedRegion)
+	{
+		File->Data = File->MappedRegion->GetMappedPtr();
+		File->Size = File->MappedRegion->GetMappedSize();
+		return File;
+	}
+
+	File->MappedHandle.Reset();
+
+	if (!FFileHelper::LoadFileToArray(File->LoadedData, *Path, FILEREAD_Silent))
+	{
+		return nullptr;
+	}
+
+	File->Data = File->LoadedData.GetData();
+	File->Size = File->LoadedData.Num();
+	return File;
+}
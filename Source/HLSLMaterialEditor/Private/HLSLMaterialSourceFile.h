@@ -0,0 +1,39 @@
+// Copyright Phyronnaz
+
+#pragma once
+
+#include "CoreMinimal.h"
+
+class IMappedFileHandle;
+class IMappedFileRegion;
+
+// Read-only view of a source file, memory mapped when the platform supports it
+// Keep it short-lived: mapped files can't be written by text editors on Windows
+class FHLSLMaterialSourceFile
+{
+public:
+	~FHLSLMaterialSourceFile();
+
+	// Retries once if the file is locked, eg while a text editor is saving it
+	static TUniquePtr<FHLSLMaterialSourceFile> Open(const FString& Path);
+
+	// Decodes the file, with \r\n converted to \n
+	FString ToString() const;
+	// Same as FHLSLMaterialUtilities::HashString(ToString()), without decoding the file
+	FGuid Hash() const;
+
+private:
+	TUniquePtr<IMappedFileHandle> MappedHandle;
+	TUniquePtr<IMappedFileRegion> MappedRegion;
+	// When mapping isn't supported
+	TArray<uint8> LoadedData;
+
+	const uint8* Data = nullptr;
+	int64 Size = 0;
+
+	FHLSLMaterialSourceFile() = default;
+
+	bool IsUTF16() const;
+
+	static TUniquePtr<FHLSLMaterialSourceFile> TryOpen(const FString& Path);
+};
@@ -0,0 +1,98 @@
+// Copyright Phyronnaz
+
+#include "HLSLMaterialTimings.h"
+#include "HLSLMaterialSettings.h"
+#include "HLSLMaterialUtilities.h"
+#include "HLSLMaterialFunctionLibrary.h"
+#include "Misc/FileHelper.h"
+#include "ProfilingDebugging/CpuProfilerTrace.h"
+
+DEFINE_STAT(STAT_HLSLMaterial_LoadFile);
+DEFINE_STAT(STAT_HLSLMaterial_Parse);
+DEFINE_STAT(STAT_HLSLMaterial_Hash);
+DEFINE_STAT(STAT_HLSLMaterial_GenerateFunction);
+DEFINE_STAT(STAT_HLSLMaterial_BuildGraph);
+DEFINE_STAT(STAT_HLSLMaterial_UpdateCode);
+DEFINE_STAT(STAT_HLSLMaterial_PostEditChange);
+DEFINE_STAT(STAT_HLSLMaterial_RefreshEditors);
+DEFINE_STAT(STAT_HLSLMaterial_MaterialUpdate);
+DEFINE_STAT(STAT_HLSLMaterial_MeasureCost);
+
+UE_TRACE_CHANNEL_DEFINE(HLSLMaterialChannel);
+
+TArray<FString> FHLSLMaterialTimings::PendingRows;
+
+FHLSLMaterialTimings::FScope::FScope(const UHLSLMaterialFunctionLibrary& Library, const TCHAR* Stage, const FString& Function)
+	: Library(Library.GetName())
+	, Stage(Stage)
+	, Function(Function)
+	, StartTime(FPlatformTime::Seconds())
+{
+#if CPUPROFILERTRACE_ENABLED
+	if (UE_TRACE_CHANNELEXPR_IS_ENABLED(HLSLMaterialChannel) &&
+		UE_TRACE_CHANNELEXPR_IS_ENABLED(CpuChannel))
+	{
+		const FString EventName = Function.IsEmpty()
+			? FString::Printf(TEXT("HLSL %s %s"), Stage, *this->Library)
+			: FString::Printf(TEXT("HLSL %s %s.%s"), Stage, *this->Library, *Function);
+
+		FCpuProfilerTrace::OutputBeginDynamicEvent(*EventName);
+		bTraceEventStarted = true;
+	}
+#endif
+}
+
+FHLSLMaterialTimings::FScope::~FScope()
+{
+#if CPUPROFILERTRACE_ENABLED
+	if (bTraceEventStarted)
+	{
+		FCpuProfilerTrace::OutputEndEvent();
+	}
+#endif
+
+	if (!GetDefault<UHLSLMaterialSettings>()->bLogTimings)
+	{
+		return;
+	}
+
+	const double Milliseconds = (FPlatformTime::Seconds() - StartTime) * 1000.;
+	PendingRows.Add(FString::Printf(TEXT("%s,%s,%s,%s,%f"),
+		*FDateTime::UtcNow().ToIso8601(),
+		*Library,
+		*Function,
+		Stage,
+		Milliseconds));
+}
+
+void FHLSLMaterialTimings::Flush()
+{
+	if (PendingRows.Num() == 0)
+	{
+		return;
+	}
+
+	const TArray<FString> Rows = MoveTemp(PendingRows);
+
+	FString Path = GetDefault<UHLSLMaterialSettings>()->TimingsLogFile.FilePath;
+	if (Path.IsEmpty())
+	{
+		Path = FPaths::ProjectSavedDir() / TEXT("HLSLMaterial") / TEXT("Timings.csv");
+	}
+	Path = FPaths::ConvertRelativePathToFull(Path);
+
+	FString Text;
+	if (!FPaths::FileExists(Path))
+	{
+		Text += "Timestamp,Library,Function,Stage,Milliseconds\n";
+	}
+	for (const FString& Row : Rows)
+	{
+		Text += Row + "\n";
+	}
+
+	if (!FFileHelper::SaveStringToFile(Text, *Path, FFileHelper::EEncodingOptions::ForceUTF8WithoutBOM, &IFileManager::Get(), FILEWRITE_Append))
+	{
+		UE_LOG(LogHLSLMaterial, Error, TEXT("Failed to write timings to %s"), *Path);
+	}
+}
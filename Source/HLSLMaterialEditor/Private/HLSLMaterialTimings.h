@@ -0,0 +1,54 @@
+// Copyright Phyronnaz
+
+#pragma once
+
+#include "CoreMinimal.h"
+#include "Stats/Stats.h"
+#include "Trace/Trace.h"
+
+class UHLSLMaterialFunctionLibrary;
+
+DECLARE_STATS_GROUP(TEXT("HLSL Material"), STATGROUP_HLSLMaterial, STATCAT_Advanced);
+
+DECLARE_CYCLE_STAT_EXTERN(TEXT("Load File"), STAT_HLSLMaterial_LoadFile, STATGROUP_HLSLMaterial, );
+DECLARE_CYCLE_STAT_EXTERN(TEXT("Parse"), STAT_HLSLMaterial_Parse, STATGROUP_HLSLMaterial, );
+DECLARE_CYCLE_STAT_EXTERN(TEXT("Hash"), STAT_HLSLMaterial_Hash, STATGROUP_HLSLMaterial, );
+DECLARE_CYCLE_STAT_EXTERN(TEXT("Generate Function"), STAT_HLSLMaterial_GenerateFunction, STATGROUP_HLSLMaterial, );
+DECLARE_CYCLE_STAT_EXTERN(TEXT("Build Graph"), STAT_HLSLMaterial_BuildGraph, STATGROUP_HLSLMaterial, );
+DECLARE_CYCLE_STAT_EXTERN(TEXT("Update Code"), STAT_HLSLMaterial_UpdateCode, STATGROUP_HLSLMaterial, );
+DECLARE_CYCLE_STAT_EXTERN(TEXT("PostEditChange"), STAT_HLSLMaterial_PostEditChange, STATGROUP_HLSLMaterial, );
+DECLARE_CYCLE_STAT_EXTERN(TEXT("Refresh Editors"), STAT_HLSLMaterial_RefreshEditors, STATGROUP_HLSLMaterial, );
+DECLARE_CYCLE_STAT_EXTERN(TEXT("Material Update"), STAT_HLSLMaterial_MaterialUpdate, STATGROUP_HLSLMaterial, );
+DECLARE_CYCLE_STAT_EXTERN(TEXT("Measure Cost"), STAT_HLSLMaterial_MeasureCost, STATGROUP_HLSLMaterial, );
+
+// Enable with -trace=cpu,HLSLMaterial
+UE_TRACE_CHANNEL_EXTERN(HLSLMaterialChannel);
+
+class FHLSLMaterialTimings
+{
+public:
+	class FScope
+	{
+	public:
+		FScope(const UHLSLMaterialFunctionLibrary& Library, const TCHAR* Stage, const FString& Function = {});
+		~FScope();
+
+	private:
+		const FString Library;
+		const TCHAR* const Stage;
+		const FString Function;
+		const double StartTime;
+		bool bTraceEventStarted = false;
+	};
+
+	// Write the timings recorded since the last flush to the timings log, if enabled
+	static void Flush();
+
+private:
+	static TArray<FString> PendingRows;
+};
+
+// Stage must match one of the STAT_HLSLMaterial_ stats
+#define HLSL_TIMING_SCOPE(Stage, Library, ...) \
+	SCOPE_CYCLE_COUNTER(STAT_HLSLMaterial_ ## Stage); \
+	const FHLSLMaterialTimings::FScope ANONYMOUS_VARIABLE(HLSLTimingScope)(Library, TEXT(#Stage), ##__VA_ARGS__);
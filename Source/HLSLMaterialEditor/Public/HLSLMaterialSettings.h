@@ -28,6 +28,20 @@ public:
 	UPROPERTY(Config, EditAnywhere, Category = "Config", meta = (DisplayName = "HLSL Editor Args"))
 	FString HLSLEditorArgs = "-g \"%FILE%:%LINE%:%CHAR%\"";
 
+	// If true, materials refreshed after a regeneration are only compiled for the editor preview feature level
+	// They are compiled for all the feature levels once they or a library are saved, or when this is turned off
+	UPROPERTY(Config, EditAnywhere, Category = "Iteration")
+	bool bCompilePreviewPlatformOnly = false;
+
+	// If true, the duration of each generation stage will be appended to the timings log as CSV
+	// Stats are also available with "stat HLSLMaterial", and Insights events with -trace=cpu,HLSLMaterial
+	UPROPERTY(Config, EditAnywhere, Category = "Profiling")
+	bool bLogTimings = false;
+
+	// The CSV file to append the timings to. Defaults to Saved/HLSLMaterial/Timings.csv
+	UPROPERTY(Config, EditAnywhere, Category = "Profiling", meta = (EditCondition = "bLogTimings"))
+	FFilePath TimingsLogFile;
+
 	virtual void PostEditChangeProperty(FPropertyChangedEvent& PropertyChangedEvent) override
 	{
 		Super::PostEditChangeProperty(PropertyChangedEvent);
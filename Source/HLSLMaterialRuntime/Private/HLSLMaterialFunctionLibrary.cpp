@@ -1,12 +1,16 @@
 // Copyright Phyronnaz
 
 #include "HLSLMaterialFunctionLibrary.h"
+#include "HLSLMaterialUtilities.h"
 #include "ShaderCore.h"
 #include "Misc/PackageName.h"
+#include "HAL/FileManager.h"
 
 #if WITH_EDITOR
 IHLSLMaterialEditorInterface* IHLSLMaterialEditorInterface::StaticInterface = nullptr;
 
+const TCHAR* UHLSLMaterialFunctionLibrary::GeneratedShaderDirectory = TEXT("/HLSLMaterialGenerated");
+
 FString UHLSLMaterialFunctionLibrary::GetFilePath() const
 {
 	return GetFilePath(File.FilePath);
@@ -38,6 +42,100 @@ void UHLSLMaterialFunctionLibrary::CreateWatcherIfNeeded()
 	}
 }
 
+EHLSLMaterialBuildProfile UHLSLMaterialFunctionLibrary::GetActiveBuildProfile()
+{
+	static const EHLSLMaterialBuildProfile Profile = []
+	{
+		FString ProfileName;
+		if (!FParse::Value(FCommandLine::Get(), TEXT("HLSLMaterialProfile="), ProfileName))
+		{
+			return EHLSLMaterialBuildProfile::Editor;
+		}
+
+		const int64 Value = StaticEnum<EHLSLMaterialBuildProfile>()->GetValueByNameString(ProfileName);
+		if (Value == INDEX_NONE)
+		{
+			UE_LOG(LogHLSLMaterial, Error, TEXT("Invalid -HLSLMaterialProfile=%s: should be Editor, Development or Shipping"), *ProfileName);
+			return EHLSLMaterialBuildProfile::Editor;
+		}
+
+		UE_LOG(LogHLSLMaterial, Log, TEXT("Using HLSL build profile %s"), *ProfileName);
+		return EHLSLMaterialBuildProfile(Value);
+	}();
+	return Profile;
+}
+
+const FHLSLMaterialBuildProfileSettings& UHLSLMaterialFunctionLibrary::GetBuildProfileSettings(EHLSLMaterialBuildProfile Profile) const
+{
+	if (Profile == EHLSLMaterialBuildProfile::Development)
+	{
+		return DevelopmentProfile;
+	}
+	if (Profile == EHLSLMaterialBuildProfile::Shipping)
+	{
+		return ShippingProfile;
+	}
+	return EditorProfile;
+}
+
+FString UHLSLMaterialFunctionLibrary::GetGeneratedShaderPath() const
+{
+	// eg /HLSLMaterialGenerated/Game/Materials/MyLibrary.ush
+	return GetGeneratedShaderDirectory() + FPackageName::ObjectPathToPackageName(GetPathName()) + ".ush";
+}
+
+FString UHLSLMaterialFunctionLibrary::GetGeneratedShaderDirectory()
+{
+	const EHLSLMaterialBuildProfile Profile = GetActiveBuildProfile();
+	if (Profile == EHLSLMaterialBuildProfile::Editor)
+	{
+		return GeneratedShaderDirectory;
+	}
+
+	return GeneratedShaderDirectory + FString("_") + StaticEnum<EHLSLMaterialBuildProfile>()->GetNameStringByValue(int64(Profile));
+}
+
+bool UHLSLMaterialFunctionLibrary::RegisterGeneratedShaderDirectory(bool bCreate)
+{
+	const auto Register = [](const FString& VirtualDirectory, const FString& Directory, bool bCreateDirectory)
+	{
+		if (AllShaderSourceDirectoryMappings().Contains(VirtualDirectory))
+		{
+			return true;
+		}
+
+		if (!FPaths::DirectoryExists(Directory))
+		{
+			if (!bCreateDirectory ||
+				!IFileManager::Get().MakeDirectory(*Directory, true))
+			{
+				return false;
+			}
+		}
+
+		AddShaderSourceDirectoryMapping(VirtualDirectory, Directory);
+		return true;
+	};
+
+	// Always mapped if it exists, as the saved materials include the files of the Editor profile
+	const bool bEditorDirectoryRegistered = Register(
+		GeneratedShaderDirectory,
+		FPaths::ConvertRelativePathToFull(FPaths::ProjectDir() / TEXT("Shaders") / TEXT("HLSLMaterialGenerated")),
+		bCreate);
+
+	const EHLSLMaterialBuildProfile Profile = GetActiveBuildProfile();
+	if (Profile == EHLSLMaterialBuildProfile::Editor)
+	{
+		return bEditorDirectoryRegistered;
+	}
+
+	// Not submitted, so always created
+	return Register(
+		GetGeneratedShaderDirectory(),
+		FPaths::ConvertRelativePathToFull(FPaths::ProjectIntermediateDir() / TEXT("HLSLMaterialGenerated") / StaticEnum<EHLSLMaterialBuildProfile>()->GetNameStringByValue(int64(Profile))),
+		true);
+}
+
 void UHLSLMaterialFunctionLibrary::PostEditChangeProperty(FPropertyChangedEvent& PropertyChangedEvent)
 {
 	Super::PostEditChangeProperty(PropertyChangedEvent);
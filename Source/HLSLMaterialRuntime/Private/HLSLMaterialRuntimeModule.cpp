@@ -3,8 +3,17 @@
 #include "CoreMinimal.h"
 #include "Modules/ModuleInterface.h"
 #include "Modules/ModuleManager.h"
+#include "HLSLMaterialFunctionLibrary.h"
 
 class FHLSLMaterialRuntimeModule : public IModuleInterface
 {
+public:
+	virtual void StartupModule() override
+	{
+#if WITH_EDITOR
+		// Needs to be done before any material including the generated shader files is loaded
+		UHLSLMaterialFunctionLibrary::RegisterGeneratedShaderDirectory(false);
+#endif
+	}
 };
 IMPLEMENT_MODULE(FHLSLMaterialRuntimeModule, HLSLMaterialRuntime);
\ No newline at end of file
@@ -2,7 +2,7 @@
 
 #include "HLSLMaterialUtilities.h"
 #include "Containers/Ticker.h"
-#include "Misc/SecureHash.h"
+#include "Hash/CityHash.h"
 
 DEFINE_LOG_CATEGORY(LogHLSLMaterial);
 
@@ -19,9 +19,50 @@ void FHLSLMaterialUtilities::DelayedCall(TFunction<void()> Call, float Delay)
 
 FString FHLSLMaterialUtilities::HashString(const FString& String)
 {
-	uint32 Hash[5];
-	const TArray<TCHAR>& Array = String.GetCharArray();
-	FSHA1::HashBuffer(Array.GetData(), Array.Num() * Array.GetTypeSize(), reinterpret_cast<uint8*>(Hash));
+	return HashStringToGuid(String).ToString();
+}
+
+FGuid FHLSLMaterialUtilities::HashStringToGuid(const FString& String)
+{
+	const FTCHARToUTF8 UTF8(*String, String.Len());
+	return HashUTF8ToGuid(UTF8.Get(), UTF8.Length());
+}
+
+FGuid FHLSLMaterialUtilities::HashUTF8ToGuid(const ANSICHAR* Text, int64 Length)
+{
+	// Two differently seeded 64 bit hashes
+	const auto Hash = [](const ANSICHAR* Data, int64 Num)
+	{
+		const uint64 HashA = CityHash64WithSeed(Data, uint32(Num), 0x9E3779B97F4A7C15ull);
+		const uint64 HashB = CityHash64WithSeed(Data, uint32(Num), 0xC2B2AE3D27D4EB4Full);
+		return FGuid(uint32(HashA >> 32), uint32(HashA), uint32(HashB >> 32), uint32(HashB));
+	};
+
+	const ANSICHAR* Read = Text;
+	const ANSICHAR* const End = Text + Length;
+
+	const ANSICHAR* CarriageReturn = static_cast<const ANSICHAR*>(memchr(Read, '\r', Length));
+	if (!CarriageReturn)
+	{
+		// No \r at all, eg files saved with LF line endings: hash in place
+		return Hash(Text, Length);
+	}
+
+	// Copy the runs between the \r\n, rather than byte by byte
+	TArray64<ANSICHAR> Normalized;
+	Normalized.SetNumUninitialized(Length);
+	ANSICHAR* Write = Normalized.GetData();
+	while (CarriageReturn)
+	{
+		const bool bIsLineEnding = CarriageReturn + 1 < End && CarriageReturn[1] == '\n';
+		const int64 Num = CarriageReturn - Read + (bIsLineEnding ? 0 : 1);
+		FMemory::Memcpy(Write, Read, Num);
+		Write += Num;
+		Read = CarriageReturn + 1;
+		CarriageReturn = static_cast<const ANSICHAR*>(memchr(Read, '\r', End - Read));
+	}
+	FMemory::Memcpy(Write, Read, End - Read);
+	Write += End - Read;
 
-	return FGuid(Hash[0] ^ Hash[4], Hash[1], Hash[2], Hash[3]).ToString();
+	return Hash(Normalized.GetData(), Write - Normalized.GetData());
 }
\ No newline at end of file
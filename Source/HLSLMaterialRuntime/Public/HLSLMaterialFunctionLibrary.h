@@ -8,6 +8,46 @@
 
 class UHLSLMaterialFunctionLibrary;
 
+UENUM()
+enum class EHLSLMaterialBudgetViolation : uint8
+{
+	// Show a warning
+	Warn,
+	// Show an error. Functions over their permutation budget won't be generated
+	// Instructions & samplers are measured on the generated function, which is kept even if over budget
+	Error
+};
+
+UENUM()
+enum class EHLSLMaterialBuildProfile : uint8
+{
+	// Used when generating in the editor
+	Editor,
+	Development,
+	Shipping
+};
+
+USTRUCT()
+struct FHLSLMaterialBuildProfileSettings
+{
+	GENERATED_BODY()
+
+	FHLSLMaterialBuildProfileSettings() = default;
+	explicit FHLSLMaterialBuildProfileSettings(bool bStripDebugOnly)
+		: bStripDebugOnly(bStripDebugOnly)
+	{
+	}
+
+	// Added to the defines of the HLSL file, replacing the ones with the same name
+	UPROPERTY(EditAnywhere, Category = "Config")
+	TArray<FCustomDefine> Defines;
+
+	// If true, [DebugOnly] functions have their body removed & their outputs zeroed,
+	// and HLSL_DEBUG_ONLY is 0 so that #if HLSL_DEBUG_ONLY blocks are compiled out
+	UPROPERTY(EditAnywhere, Category = "Config")
+	bool bStripDebugOnly = false;
+};
+
 #if WITH_EDITOR
 class HLSLMATERIALRUNTIME_API IHLSLMaterialEditorInterface
 {
@@ -64,12 +104,50 @@ public:
 	UPROPERTY(EditAnywhere, Category = "Config")
 	bool bAccurateErrors = true;
 
+	// If true, comments & whitespace will be stripped from the generated code, and the library path & hash won't be embedded in it
+	// Functionally identical code will then produce byte-identical shaders, maximizing shader DDC hits
+	//
+	// This disables bAccurateErrors, as #line directives change whenever a line is added above a function
+	UPROPERTY(EditAnywhere, Category = "Config")
+	bool bCanonicalCode = false;
+
+	// If true, the functions, structs & defines will be written once to a generated shader file in Shaders/HLSLMaterialGenerated,
+	// and the Custom nodes will only include it & call the function. Makes materials & assets smaller, and compile faster
+	// Non-void functions and functions with [Helper] are only written to the file, and can be called by the other functions
+	//
+	// The generated file needs to be submitted to source control along with the generated assets
+	// Editing any function will recompile all the materials using the library
+	UPROPERTY(EditAnywhere, Category = "Config")
+	bool bGenerateShaderFile = false;
+
+	// If true, bool pins are passed as scalars & branched on dynamically in a single Custom node, instead of being static bools
+	// selecting between 2^N permutations. Compiles faster & makes smaller materials, but the branches have a runtime cost
+	// Use [Static] or [Dynamic] on a pin to override this
+	UPROPERTY(EditAnywhere, Category = "Config")
+	bool bDynamicBools = false;
+
 	UPROPERTY(EditAnywhere, Category = "Config")
 	bool bAutomaticallyApply = true;
 
+	// What to do when a function exceeds one of its budgets, eg [MaxInstructions = 200, MaxSamplers = 4, MaxPermutations = 8]
+	// Instructions & samplers are measured by compiling the function for the editor shader platform after generating it
+	UPROPERTY(EditAnywhere, Category = "Config")
+	EHLSLMaterialBudgetViolation BudgetViolation = EHLSLMaterialBudgetViolation::Warn;
+
 	UPROPERTY(EditAnywhere, Category = "Config")
 	TArray<FText> Categories = { NSLOCTEXT("MaterialExpression", "Misc", "Misc") };
 
+	// Functions are generated with the Editor profile, unless another one is selected with -HLSLMaterialProfile=Development or Shipping
+	// When cooking with -HLSLMaterialProfile, all libraries are regenerated in memory with that profile before anything is cooked
+	UPROPERTY(EditAnywhere, Category = "Build Profiles")
+	FHLSLMaterialBuildProfileSettings EditorProfile;
+
+	UPROPERTY(EditAnywhere, Category = "Build Profiles")
+	FHLSLMaterialBuildProfileSettings DevelopmentProfile;
+
+	UPROPERTY(EditAnywhere, Category = "Build Profiles")
+	FHLSLMaterialBuildProfileSettings ShippingProfile = FHLSLMaterialBuildProfileSettings(true);
+
 	UPROPERTY(EditAnywhere, Category = "Generated")
 	TArray<TSoftObjectPtr<UMaterialFunction>> MaterialFunctions;
 #endif
@@ -81,6 +159,21 @@ public:
 
 	void CreateWatcherIfNeeded();
 
+	// Selected with -HLSLMaterialProfile=, Editor by default
+	static EHLSLMaterialBuildProfile GetActiveBuildProfile();
+	const FHLSLMaterialBuildProfileSettings& GetBuildProfileSettings(EHLSLMaterialBuildProfile Profile) const;
+
+	// Virtual shader path of the file generated with the active build profile when bGenerateShaderFile is true
+	FString GetGeneratedShaderPath() const;
+
+	static const TCHAR* GeneratedShaderDirectory;
+	// GeneratedShaderDirectory for the Editor profile, eg /HLSLMaterialGenerated_Shipping for the others
+	static FString GetGeneratedShaderDirectory();
+	// Map GeneratedShaderDirectory to Shaders/HLSLMaterialGenerated. If !bCreate, will only do so if the directory exists
+	// The files of the other profiles are only generated by the cook, and are mapped to Intermediate/HLSLMaterialGenerated/Profile
+	// so that the submitted files are left untouched
+	static bool RegisterGeneratedShaderDirectory(bool bCreate);
+
 	//~ Begin UObject Interface
 	virtual void PostEditChangeProperty(FPropertyChangedEvent& PropertyChangedEvent) override;
 	virtual void BeginDestroy() override;
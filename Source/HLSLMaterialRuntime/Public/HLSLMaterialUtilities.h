@@ -10,7 +10,10 @@ struct HLSLMATERIALRUNTIME_API FHLSLMaterialUtilities
 	// Delay until next fire; 0 means "next frame"
 	static void DelayedCall(TFunction<void()> Call, float Delay = 0);
 
+	// 128 bit hash of the UTF-8 text with \r\n normalized to \n, so that it's the same on all platforms & line ending settings
 	static FString HashString(const FString& String);
+	static FGuid HashStringToGuid(const FString& String);
+	static FGuid HashUTF8ToGuid(const ANSICHAR* Text, int64 Length);
 };
 
 HLSLMATERIALRUNTIME_API DECLARE_LOG_CATEGORY_EXTERN(LogHLSLMaterial, Log, All);